@@ -0,0 +1,80 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "tqdm/utils.h"
+
+/**
+Many local processes sending increments to one AggregateServer (as
+`tqdm aggregate` does): cost of `AggregateClient::update()` in each
+worker (in CPU time, as the workers may well outnumber the cores), and
+how many datagrams it took to carry all the increments.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point t0) {
+  return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+static double cpu_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return double(ts.tv_sec) + ts.tv_nsec * 1e-9;
+}
+
+int main() {
+  static const int CLIENTS = 32;
+  static const size_t UPDATES = 1 << 23;  // per client
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench-aggregate.%d", int(getpid()));
+  tqdm::AggregateServer server(path);
+  if (!server.ok()) {
+    perror(path);
+    return 1;
+  }
+
+  int fds[2];
+  if (pipe(fds))
+    return 1;
+  Clock::time_point t0 = Clock::now();
+  for (int c = 0; c < CLIENTS; ++c) {
+    if (fork())
+      continue;
+    double secs;
+    {
+      tqdm::AggregateClient client(path);
+      double start = cpu_seconds();
+      for (size_t i = 0; i < UPDATES; ++i)
+        client.update();
+      secs = cpu_seconds() - start;
+    }
+    _exit(write(fds[1], &secs, sizeof(secs)) == sizeof(secs) ? 0 : 1);
+  }
+
+  size_t total = 0;
+  while (total < CLIENTS * UPDATES && seconds_since(t0) < 60)
+    total += server.receive(std::chrono::milliseconds(100));
+  double wall = seconds_since(t0);
+
+  double worst = 0, sum = 0;
+  for (int c = 0; c < CLIENTS; ++c) {
+    double secs = 0;
+    if (read(fds[0], &secs, sizeof(secs)) != sizeof(secs))
+      return 1;
+    sum += secs;
+    worst = secs > worst ? secs : worst;
+    wait(nullptr);
+  }
+  printf("%d clients x %zu updates: %.2f ns/update (worst client %.2f)\n",
+         CLIENTS, UPDATES, sum * 1e9 / (CLIENTS * double(UPDATES)),
+         worst * 1e9 / UPDATES);
+  printf("received %zu/%zu in %zu datagrams (%.0f updates each), %.2f s\n",
+         total, CLIENTS * UPDATES, server.received(),
+         double(total) / double(server.received() ? server.received() : 1),
+         wall);
+  return total == CLIENTS * UPDATES ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#include "../src/stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "tqdm/tqdm.h"
+
+/**
+Register/unregister churn on an AtomicList<AbstractLine>, as done by
+short-lived bars, while another thread keeps walking the list (as a Sink's
+render thread would).
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+int main() {
+  static const int OPS = 100000;
+  unsigned max_threads = std::thread::hardware_concurrency();
+  if (max_threads < 4)
+    max_threads = 4;
+
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    tqdm::AtomicList<tqdm::AbstractLine> lines;
+    tqdm::StaticTextLine resident("resident");
+    lines.append(&resident);
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> walks(0);
+    std::thread walker([&] {
+      while (!stop.load()) {
+        lines.for_each([](tqdm::AbstractLine *) {});
+        walks.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+
+    Clock::time_point t0 = Clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+      workers.emplace_back([&] {
+        for (int i = 0; i < OPS; ++i) {
+          tqdm::StaticTextLine line("short-lived");
+          lines.append(&line);
+          lines.unlink(&line);
+        }
+      });
+    for (std::thread &t : workers)
+      t.join();
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - t0).count();
+    stop.store(true);
+    walker.join();
+    lines.unlink(&resident);
+
+    printf("%3u threads: %10.0f append+unlink/s (%zu concurrent walks)\n",
+           threads, threads * OPS / elapsed, walks.load());
+  }
+  return 0;
+}
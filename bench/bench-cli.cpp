@@ -0,0 +1,78 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+/**
+Throughput of the `tqdm` binary (counting bytes, and counting lines)
+versus `cat`, for file and pipe input.
+Run from the build directory (as `make bench` does), or pass the path to
+`tqdm` as the first argument.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static double gbps(const std::string &cmd, size_t bytes) {
+  double best = 1e30;
+  for (int repeat = 0; repeat < 3; ++repeat) {
+    Clock::time_point t0 = Clock::now();
+    if (system(cmd.c_str()) != 0) {
+      fprintf(stderr, "failed: %s\n", cmd.c_str());
+      exit(1);
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    if (secs < best)
+      best = secs;
+  }
+  return bytes / best / 1e9;
+}
+
+int main(int argc, char **argv) {
+  static const size_t SIZE = size_t(512) << 20;
+  std::string tqdm = argc > 1 ? argv[1] : "./tqdm";
+  char path[] = "/tmp/tqdm-bench-cli-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    perror("mkstemp");
+    return 1;
+  }
+  std::vector<char> block(1 << 20);
+  for (size_t i = 0; i < block.size(); ++i)
+    block[i] = i % 80 == 79 ? '\n' : char('a' + i % 26);
+  for (size_t done = 0; done < SIZE; done += block.size())
+    if (::write(fd, block.data(), block.size()) != (ssize_t)block.size()) {
+      perror("write");
+      return 1;
+    }
+  close(fd);
+
+  struct Shape {
+    const char *name;
+    std::string (*cmd)(const std::string &prog, const std::string &in);
+  } shapes[] = {
+      {"file -> /dev/null",
+       [](const std::string &prog, const std::string &in) {
+         return prog + " < " + in + " > /dev/null";
+       }},
+      {"file -> pipe",
+       [](const std::string &prog, const std::string &in) {
+         return prog + " < " + in + " | cat > /dev/null";
+       }},
+      {"pipe -> /dev/null",
+       [](const std::string &prog, const std::string &in) {
+         return "cat " + in + " | " + prog + " > /dev/null";
+       }},
+  };
+  printf("%-18s  %8s  %12s  %12s  (GB/s)\n", "", "cat", "tqdm --bytes",
+         "tqdm (lines)");
+  for (const Shape &shape : shapes)
+    printf("%-18s  %8.2f  %12.2f  %12.2f\n", shape.name,
+           gbps(shape.cmd("cat", path), SIZE),
+           gbps(shape.cmd(tqdm + " --bytes 2>/dev/null", path), SIZE),
+           gbps(shape.cmd(tqdm + " 2>/dev/null", path), SIZE));
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include "tqdm/utils.h"
+
+/**
+Clocks a bar may use (see TQDM_CLOCK): cost of one `now()`, and how far
+off an interval measured with each is from steady_clock's, i.e. the
+relative error of a rate shown after `mininterval`.
+*/
+
+typedef std::chrono::steady_clock Steady;
+
+template <class Clock> static double ns_per_read() {
+  static const int READS = 1 << 22;
+  typename Clock::rep sink = 0;
+  double best = 1e9;
+  for (int r = 0; r < 3; ++r) {
+    Steady::time_point t0 = Steady::now();
+    for (int i = 0; i < READS; ++i)
+      sink += Clock::now().time_since_epoch().count() & 1;
+    double t = std::chrono::duration<double>(Steady::now() - t0).count();
+    best = t < best ? t : best;
+  }
+  return best * 1e9 / READS + double(sink) * 0.0;
+}
+
+// worst relative error over a few intervals of `window`
+template <class Clock> static double max_error(Steady::duration window) {
+  double worst = 0;
+  for (int r = 0; r < 5; ++r) {
+    typename Clock::time_point c0 = Clock::now();
+    Steady::time_point s0 = Steady::now(), s1;
+    do
+      s1 = Steady::now();
+    while (s1 - s0 < window);
+    typename Clock::time_point c1 = Clock::now();
+    double ref = std::chrono::duration<double>(s1 - s0).count();
+    double got = std::chrono::duration<double>(c1 - c0).count();
+    double err = std::fabs(got - ref) / ref;
+    worst = err > worst ? err : worst;
+  }
+  return worst;
+}
+
+template <class Clock> static void run(const char *name) {
+  Clock::now();  // calibrate, if need be
+  printf("%-14s %6.1f ns/read  max error: %8.5f%% @1ms %8.5f%% @10ms"
+         " %8.5f%% @100ms\n",
+         name, ns_per_read<Clock>(),
+         100 * max_error<Clock>(std::chrono::milliseconds(1)),
+         100 * max_error<Clock>(std::chrono::milliseconds(10)),
+         100 * max_error<Clock>(std::chrono::milliseconds(100)));
+}
+
+int main() {
+  run<Steady>("steady_clock");
+  run<tqdm::CoarseClock>("CoarseClock");
+  run<tqdm::TscClock>(tqdm::TscClock::uses_tsc() ? "TscClock"
+                                                  : "TscClock (off)");
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include "../src/stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <vector>
+#include "tqdm/tqdm.h"
+
+/**
+Many threads updating one bar: ConcurrentTqdm (sharded counters) versus
+all threads doing fetch_add on a single shared counter.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+template <class F> double run(unsigned threads, size_t ops, F f) {
+  Clock::time_point t0 = Clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t)
+    workers.emplace_back([&] {
+      for (size_t i = 0; i < ops; ++i)
+        f();
+    });
+  for (std::thread &t : workers)
+    t.join();
+  return threads * ops /
+         std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+int main() {
+  static const size_t OPS = 1 << 22;
+  unsigned max_threads = std::thread::hardware_concurrency();
+  if (max_threads < 4)
+    max_threads = 4;
+
+  int devnull = open("/dev/null", O_WRONLY);
+  tqdm::SinkOptions opts(devnull);
+  tqdm::Sink sink(opts);
+
+  printf("threads  shared fetch_add  ConcurrentTqdm  (Mupdates/s)\n");
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    std::atomic<size_t> shared(0);
+    double contended = run(threads, OPS, [&] {
+      shared.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    tqdm::Params p;
+    p.total = threads * OPS;
+    tqdm::ConcurrentTqdm bar(p, sink);
+    double sharded = run(threads, OPS, [&] { bar.update(); });
+
+    printf("%7u  %16.1f  %14.1f\n", threads, contended / 1e6, sharded / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <vector>
+#include "tqdm/coro.h"
+
+/**
+Per-`co_yield` cost of a generator wrapped by tqdm::co_tqdm, and
+per-completion cost of tqdm::counted, each against the bare coroutine.
+
+Built with `-std=c++20` where the compiler supports it; otherwise this
+only says so.
+*/
+
+#if TQDM_COROUTINES
+
+typedef std::chrono::steady_clock Clock;
+
+template <class F> static double best_of(int repeats, F f) {
+  double best = 1e9;
+  for (int r = 0; r < repeats; ++r) {
+    Clock::time_point t0 = Clock::now();
+    f();
+    double t = std::chrono::duration<double>(Clock::now() - t0).count();
+    best = t < best ? t : best;
+  }
+  return best;
+}
+
+static void report(const char *name, double bare, double wrapped,
+                   size_t n) {
+  printf("%-10s bare %.2f ns, wrapped %.2f ns (%+.2f ns)\n", name,
+         bare * 1e9 / n, wrapped * 1e9 / n, (wrapped - bare) * 1e9 / n);
+}
+
+static tqdm::generator<unsigned> iota(unsigned n) {
+  for (unsigned i = 0; i < n; ++i)
+    co_yield i * 2654435761u;
+}
+
+// An "async" operation: suspends until the event loop below resumes it.
+struct Later {
+  std::vector<std::coroutine_handle<>> *queue;
+  unsigned value;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) { queue->push_back(h); }
+  unsigned await_resume() const noexcept { return value; }
+};
+
+// Eager, fire-and-forget: runs until its first suspension.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+static Task client(std::vector<std::coroutine_handle<>> &queue, unsigned n,
+                   tqdm::ConcurrentTqdm *bar, volatile unsigned &out) {
+  unsigned sum = 0;
+  for (unsigned i = 0; i < n; ++i)
+    sum ^= bar ? co_await tqdm::counted(*bar, Later{&queue, i})
+               : co_await Later{&queue, i};
+  out = sum;
+}
+
+static void run_loop(std::vector<std::coroutine_handle<>> &queue) {
+  std::vector<std::coroutine_handle<>> ready;
+  while (!queue.empty()) {
+    ready.swap(queue);
+    for (std::coroutine_handle<> h : ready)
+      h.resume();
+    ready.clear();
+  }
+}
+
+int main() {
+  static const unsigned N = 1 << 24;
+  static const unsigned CLIENTS = 64;
+  static const int REPEATS = 5;
+
+  int devnull = open("/dev/null", O_WRONLY);
+  tqdm::SinkOptions opts(devnull);
+  tqdm::Sink sink(opts);
+  tqdm::Params p;
+  p.total = N;
+
+  volatile unsigned out = 0;
+  double bare = best_of(REPEATS, [&] {
+    unsigned sum = 0;
+    for (unsigned x : iota(N))
+      sum ^= x;
+    out = sum;
+  });
+  double wrapped = best_of(REPEATS, [&] {
+    unsigned sum = 0;
+    auto bar = tqdm::co_tqdm(iota(N), p, sink);
+    for (unsigned x : bar)
+      sum ^= x;
+    assert(bar.count() == N);
+    out = sum;
+  });
+  report("co_yield", bare, wrapped, N);
+
+  std::vector<std::coroutine_handle<>> queue;
+  bare = best_of(REPEATS, [&] {
+    for (unsigned c = 0; c < CLIENTS; ++c)
+      client(queue, N / CLIENTS, nullptr, out);
+    run_loop(queue);
+  });
+  wrapped = best_of(REPEATS, [&] {
+    tqdm::ConcurrentTqdm bar(p, sink);
+    for (unsigned c = 0; c < CLIENTS; ++c)
+      client(queue, N / CLIENTS, &bar, out);
+    run_loop(queue);
+    assert(bar.count() == N);
+  });
+  report("co_await", bare, wrapped, N);
+
+  close(devnull);
+  return 0;
+}
+
+#else
+
+int main() {
+  printf("bench-coro: needs C++20 coroutines\n");
+  return 0;
+}
+
+#endif  // TQDM_COROUTINES
@@ -0,0 +1,82 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+#define TQDM_DISABLE
+#include "tqdm/tqdm.h"
+
+/**
+With TQDM_DISABLE, tqdm::tqdm(v) and tqdm::range(n) must collapse to the
+raw iterators: checked at compile time, and timed against the bare loops.
+*/
+
+typedef std::vector<float>::iterator VecIt;
+static_assert(std::is_same<decltype(tqdm::tqdm(std::declval<
+                                               std::vector<float> &>())
+                                        .begin()),
+                           VecIt>::value,
+              "disabled tqdm(v) should iterate over raw iterators");
+static_assert(sizeof(tqdm::NoTqdm<VecIt>) == 2 * sizeof(VecIt),
+              "disabled tqdm(v) should hold only begin and end");
+static_assert(std::is_same<decltype(tqdm::range(1).begin()),
+                           tqdm::RangeIterator<int>>::value,
+              "disabled range(n) should iterate over a plain counter");
+
+typedef std::chrono::steady_clock Clock;
+
+template <class F> static double best_of(int repeats, F f) {
+  double best = 1e9;
+  for (int r = 0; r < repeats; ++r) {
+    Clock::time_point t0 = Clock::now();
+    f();
+    double t = std::chrono::duration<double>(Clock::now() - t0).count();
+    best = t < best ? t : best;
+  }
+  return best;
+}
+
+static void report(const char *name, double bare, double disabled,
+                   size_t n) {
+  printf("%-8s bare %.3f ns/it, disabled %.3f ns/it (%+.1f%%)\n", name,
+         bare * 1e9 / n, disabled * 1e9 / n, (disabled / bare - 1) * 100);
+}
+
+int main() {
+  static const size_t N = 1 << 24;
+  static const int REPEATS = 8;
+  std::vector<float> v(N);
+  for (size_t i = 0; i < N; ++i)
+    v[i] = float(i % 7);
+
+  volatile float sink_f = 0;
+  double bare = best_of(REPEATS, [&] {
+    float sum = 0;
+    for (float x : v)
+      sum += x;
+    sink_f = sum;
+  });
+  double disabled = best_of(REPEATS, [&] {
+    float sum = 0;
+    for (float x : tqdm::tqdm(v))
+      sum += x;
+    sink_f = sum;
+  });
+  report("tqdm(v)", bare, disabled, N);
+
+  volatile unsigned sink_u = 0;
+  bare = best_of(REPEATS, [&] {
+    unsigned sum = 0;
+    for (unsigned i = 0; i < N; ++i)
+      sum ^= i * 2654435761u;
+    sink_u = sum;
+  });
+  disabled = best_of(REPEATS, [&] {
+    unsigned sum = 0;
+    for (unsigned i : tqdm::range(unsigned(N)))
+      sum ^= i * 2654435761u;
+    sink_u = sum;
+  });
+  report("range(n)", bare, disabled, N);
+  return 0;
+}
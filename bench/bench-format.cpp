@@ -0,0 +1,56 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "tqdm/tqdm.h"
+
+/**
+Cost of rendering one meter frame with MeterFormat, and the number of heap
+allocations made while doing so (expected: 0).
+*/
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+typedef std::chrono::steady_clock Clock;
+
+static void run(const char *name, const tqdm::Params &p) {
+  static const size_t FRAMES = 1 << 20;
+  tqdm::MeterFormat fmt(p);
+  char buf[256];
+  size_t chars = 0, allocs = allocations;
+  Clock::time_point t0 = Clock::now();
+  for (size_t i = 0; i < FRAMES; ++i)
+    chars += fmt.format(buf, sizeof(buf), i * 37 % 1000000,
+                        float(i) * 1e-3f, 12345.6f);
+  double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+  printf("%-22s %7.1f ns/frame  %zu allocations  (%zu chars)\n", name,
+         secs * 1e9 / FRAMES, allocations - allocs, chars / FRAMES);
+}
+
+int main() {
+  tqdm::Params p;
+  p.total = 1000000;
+  p.desc = "bench";
+  run("default", p);
+  p.ncols = 120;
+  run("default, ncols=120", p);
+  p.unit = "B";
+  p.unit_scale = true;
+  run("unit_scale", p);
+  p.bar_format = "{desc}{n}/{total} {percentage:5.1f}% |{bar}| {rate:.2f}";
+  run("custom bar_format", p);
+  p.bar_format.clear();
+  p.total = size_t(-1);
+  run("unknown total", p);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include "tqdm/parallel.h"
+
+/**
+Scaling of tqdm::parallel_reduce over tqdm::range(n) with 1..hardware
+threads, against a plain serial loop. Each item is ~35ns of integer work.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+// 64-bit multiplies, so that the serial baseline isn't vectorised either
+static uint64_t work(uint64_t x) {
+  for (int k = 0; k < 32; ++k) {
+    x *= 0x9E3779B97F4A7C15ull;
+    x ^= x >> 29;
+  }
+  return x;
+}
+
+static double seconds_since(Clock::time_point t0) {
+  return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+int main() {
+  static const uint64_t N = 1 << 23;
+  static const int REPEATS = 3;
+  unsigned max_threads = std::thread::hardware_concurrency();
+  if (max_threads < 2)
+    max_threads = 2;
+
+  double serial = 1e9;
+  uint64_t expected = 0;
+  for (int r = 0; r < REPEATS; ++r) {
+    Clock::time_point t0 = Clock::now();
+    expected = 0;
+    for (uint64_t i = 0; i < N; ++i)
+      expected ^= work(i + 1);
+    double t = seconds_since(t0);
+    serial = t < serial ? t : serial;
+  }
+  printf("serial:     %.3f s\n", serial);
+
+  int mismatches = 0;
+  tqdm::Params p;
+  p.leave = false;
+  for (unsigned threads = 1; threads <= max_threads;
+       threads = threads < max_threads && threads * 2 > max_threads
+                     ? max_threads
+                     : threads * 2) {
+    tqdm::ThreadPool pool(threads);
+    double best = 1e9;
+    for (int r = 0; r < REPEATS; ++r) {
+      Clock::time_point t0 = Clock::now();
+      uint64_t got = tqdm::parallel_reduce(
+          tqdm::range(N), uint64_t(0),
+          [](uint64_t a, uint64_t b) { return a ^ b; },
+          [](uint64_t i) { return work(i + 1); }, p, pool);
+      double t = seconds_since(t0);
+      best = t < best ? t : best;
+      mismatches += got != expected;
+    }
+    printf("\r%3u threads: %.3f s, speedup %5.2fx, efficiency %3.0f%%\n",
+           threads, best, serial / best, 100 * serial / best / threads);
+  }
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <unistd.h>
+#include <vector>
+#include "tqdm/tqdm.h"
+
+/**
+Many short-lived bars configured alike (e.g. one per file or request):
+size of a bar, and the cost (time and heap allocations) of making,
+running and closing one, from a `Params` copied each time or from one
+`SharedParams`.
+*/
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+typedef std::chrono::steady_clock Clock;
+static const size_t BARS = 100000;
+
+template <class P> static void run(const char *name, const P &p) {
+  std::vector<int> v(64, 1);
+  size_t sum = 0, allocs = allocations;
+  Clock::time_point t0 = Clock::now();
+  for (size_t b = 0; b < BARS; ++b)
+    for (int x : tqdm::tqdm(v, p))
+      sum += size_t(x);
+  double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+  printf("%-16s %7.1f ns/bar  %.1f allocations/bar%s\n", name,
+         secs * 1e9 / BARS, double(allocations - allocs) / BARS,
+         sum == BARS * v.size() ? "" : "  (wrong sum)");
+}
+
+int main() {
+  printf("sizeof Params %zu, Tqdm<int *> %zu, Meter<> %zu\n",
+         sizeof(tqdm::Params), sizeof(tqdm::Tqdm<int *>),
+         sizeof(tqdm::Meter<>));
+  // bars go to stderr as usual, but stderr is /dev/null
+  int null = open("/dev/null", O_WRONLY);
+  if (null < 0 || dup2(null, STDERR_FILENO) < 0)
+    return 1;
+  tqdm::Params p;
+  p.desc = "processing records";
+  p.unit = "records";
+  p.leave = false;
+  run("Params", p);
+  run("SharedParams", tqdm::SharedParams(p));
+  run("defaults", tqdm::SharedParams());
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include "../src/stdafx.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "tqdm/tqdm.h"
+
+/**
+Sum of a std::vector<float>, bare vs wrapped by tqdm::tqdm(v), and vs
+tqdm::tqdm(v).chunks(K) (progress counted once per block of K).
+The wrapped loops should be within a few percent of the bare one.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point t0) {
+  return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+int main() {
+  static const size_t N = 1 << 24;
+  static const int REPEATS = 8;
+  std::vector<float> v(N);
+  for (size_t i = 0; i < N; ++i)
+    v[i] = float(i % 7);
+
+  static const size_t K = 4096;
+  double bare = 1e9, wrapped = 1e9, chunked = 1e9;
+  int mismatches = 0;
+  for (int r = 0; r < REPEATS; ++r) {
+    Clock::time_point t0 = Clock::now();
+    float sum = 0;
+    for (float x : v)
+      sum += x;
+    double t = seconds_since(t0);
+    bare = t < bare ? t : bare;
+    float expected = sum;
+
+    t0 = Clock::now();
+    sum = 0;
+    for (float x : tqdm::tqdm(v))
+      sum += x;
+    t = seconds_since(t0);
+    wrapped = t < wrapped ? t : wrapped;
+    mismatches += sum != expected;
+
+    t0 = Clock::now();
+    sum = 0;
+    for (auto block : tqdm::tqdm(v).chunks(K))
+      for (float x : block)
+        sum += x;
+    t = seconds_since(t0);
+    chunked = t < chunked ? t : chunked;
+    mismatches += sum != expected;
+  }
+
+  printf("bare:    %.3f ns/it\n", bare * 1e9 / N);
+  printf("wrapped: %.3f ns/it\n", wrapped * 1e9 / N);
+  printf("overhead: %+.1f%%\n", (wrapped / bare - 1) * 100);
+  printf("chunked: %.3f ns/it (%+.1f%%)\n", chunked * 1e9 / N,
+         (chunked / bare - 1) * 100);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+/**
+Progress for C++20 coroutines: generators and `co_await`ed operations.
+
+Usage:
+  # include "tqdm/coro.h"
+  tqdm::generator<const Row &> rows(std::istream &in);
+  for (const Row &r : tqdm::co_tqdm(rows(in)))
+    ...
+
+  tqdm::ConcurrentTqdm bar(p);
+  Reply r = co_await tqdm::counted(bar, client.get(key));
+
+Both count into a BasicConcurrentTqdm, so a yield or a completion costs
+one add, and the line is drawn by its Sink's render thread: never from
+inside the coroutine being resumed. A generator is drained by one thread
+at a time, so its count needs no atomic read-modify-write.
+
+Opt-in and feature-tested: without coroutine support (e.g. `-std=c++11`)
+this header declares nothing, and `TQDM_COROUTINES` is 0.
+*/
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define TQDM_COROUTINES 1
+#endif
+#endif
+#ifndef TQDM_COROUTINES
+#define TQDM_COROUTINES 0
+#endif
+
+#if TQDM_COROUTINES
+
+#include <coroutine>    // coroutine_handle, suspend_always
+#include <cstddef>      // ptrdiff_t
+#include <exception>    // exception_ptr
+#include <iterator>     // begin, end, iter_value_t
+#include <memory>       // addressof
+#include <type_traits>  // remove_reference_t, remove_cvref_t
+#include <utility>      // exchange, forward
+#include "tqdm/tqdm.h"
+
+namespace tqdm {
+
+/**
+A minimal lazy generator (until std::generator is available): an input
+range whose elements are `co_yield`ed one at a time. Yielded values are
+referred to, not copied, so they must only be used before the next
+increment.
+*/
+template <class T> class generator {
+public:
+  using value_type = std::remove_cvref_t<T>;
+  using reference =
+      std::conditional_t<std::is_reference_v<T>, T, const value_type &>;
+
+  struct promise_type {
+    std::remove_reference_t<reference> *value = nullptr;
+    std::exception_ptr error;
+
+    generator get_return_object() {
+      return generator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // rvalues (temporaries) live until the coroutine is resumed
+    std::suspend_always
+    yield_value(std::remove_reference_t<reference> &v) noexcept {
+      value = std::addressof(v);
+      return {};
+    }
+    std::suspend_always
+    yield_value(std::remove_reference_t<reference> &&v) noexcept {
+      value = std::addressof(v);
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() { error = std::current_exception(); }
+    // no `co_await` in a generator
+    template <class U> std::suspend_never await_transform(U &&) = delete;
+  };
+
+  class iterator {
+    std::coroutine_handle<promise_type> h;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = generator::value_type;
+
+    iterator() = default;
+    explicit iterator(std::coroutine_handle<promise_type> h) : h(h) {}
+
+    reference operator*() const {
+      return static_cast<reference>(*h.promise().value);
+    }
+    iterator &operator++() {
+      h.resume();
+      if (h.done() && h.promise().error)
+        std::rethrow_exception(std::exchange(h.promise().error, nullptr));
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    bool operator==(std::default_sentinel_t) const { return !h || h.done(); }
+  };
+
+  generator(generator &&other) noexcept
+      : h(std::exchange(other.h, nullptr)) {}
+  generator &operator=(generator other) noexcept {
+    std::swap(h, other.h);
+    return *this;
+  }
+  ~generator() {
+    if (h)
+      h.destroy();
+  }
+
+  // Starts the coroutine: only call once.
+  iterator begin() {
+    return ++iterator(h);
+  }
+  std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+  std::coroutine_handle<promise_type> h;
+  explicit generator(std::coroutine_handle<promise_type> h) : h(h) {}
+};
+
+/**
+Counts the elements taken from any input range `_Range` (held by
+reference if given an lvalue, otherwise moved in), e.g. a generator.
+Unlike Tqdm, its iterators may be move-only and its end a sentinel.
+*/
+template <class _Range> class GeneratorTqdm {
+  typedef BasicConcurrentTqdm<SingleWriterCounter> _Bar;
+  _Range range;
+  _Bar bar;
+
+  using _It = decltype(std::begin(std::declval<_Range &>()));
+  using _End = decltype(std::end(std::declval<_Range &>()));
+
+public:
+  class iterator {
+    _It it;
+    _Bar *bar;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::iter_value_t<_It>;
+
+    iterator() = default;
+    iterator(_It it, _Bar *bar) : it(std::move(it)), bar(bar) {}
+
+    decltype(auto) operator*() const { return *it; }
+    // the element is done with (even if fetching the next one throws)
+    iterator &operator++() {
+      bar->update();
+      ++it;
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    bool operator==(const _End &end) const { return it == end; }
+  };
+
+  GeneratorTqdm(_Range &&range, const Params &p, Sink &sink)
+      : range(std::forward<_Range>(range)), bar(p, sink) {}
+
+  iterator begin() { return iterator(std::begin(range), &bar); }
+  _End end() { return std::end(range); }
+  size_t count() const { return bar.count(); }
+};
+
+template <class _Range>
+GeneratorTqdm<_Range> co_tqdm(_Range &&range, const Params &p = Params(),
+                              Sink &sink = standard_sink()) {
+  return GeneratorTqdm<_Range>(std::forward<_Range>(range), p, sink);
+}
+
+namespace detail {
+// `co_await x` without a promise's await_transform: x's own (member or
+// free) operator co_await, if any, else x itself.
+template <class _Aw>
+decltype(auto) _get_awaiter(_Aw &&aw) {
+  if constexpr (requires { std::forward<_Aw>(aw).operator co_await(); })
+    return std::forward<_Aw>(aw).operator co_await();
+  else if constexpr (requires { operator co_await(std::forward<_Aw>(aw)); })
+    return operator co_await(std::forward<_Aw>(aw));
+  else
+    return std::forward<_Aw>(aw);
+}
+}  // detail
+
+/**
+Awaits `_Awaitable` (held by reference if given an lvalue, otherwise
+moved in), then counts one completion, whether it returned or threw.
+Completions may resume on any thread, unless `_Bar` counts with a
+SingleWriterCounter.
+*/
+template <class _Awaitable, class _Bar = ConcurrentTqdm>
+class CountedAwaitable {
+  _Awaitable aw;
+  _Bar &bar;
+
+  template <class _Awaiter> struct awaiter {
+    _Awaiter inner;
+    _Bar &bar;
+
+    struct _Count {
+      _Bar &bar;
+      ~_Count() { bar.update(); }
+    };
+
+    bool await_ready() { return inner.await_ready(); }
+    template <class _Promise>
+    decltype(auto) await_suspend(std::coroutine_handle<_Promise> h) {
+      return inner.await_suspend(h);
+    }
+    decltype(auto) await_resume() {
+      _Count count{bar};
+      return inner.await_resume();
+    }
+  };
+  template <class _Awaiter>
+  static awaiter<_Awaiter> _wrap(_Awaiter &&inner, _Bar &bar) {
+    return {std::forward<_Awaiter>(inner), bar};
+  }
+
+public:
+  CountedAwaitable(_Awaitable &&aw, _Bar &bar)
+      : aw(std::forward<_Awaitable>(aw)), bar(bar) {}
+
+  auto operator co_await() && {
+    return _wrap(detail::_get_awaiter(std::forward<_Awaitable>(aw)), bar);
+  }
+};
+
+template <class _Counter, class _Awaitable>
+CountedAwaitable<_Awaitable, BasicConcurrentTqdm<_Counter>>
+counted(BasicConcurrentTqdm<_Counter> &bar, _Awaitable &&aw) {
+  return CountedAwaitable<_Awaitable, BasicConcurrentTqdm<_Counter>>(
+      std::forward<_Awaitable>(aw), bar);
+}
+
+}  // tqdm
+
+#endif  // TQDM_COROUTINES
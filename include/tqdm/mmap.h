@@ -0,0 +1,181 @@
+#pragma once
+
+/**
+Progress over a file of fixed-size records, read through mmap.
+
+Usage:
+  # include "tqdm/mmap.h"
+  for (const Record &r : tqdm::mapped_file<Record>("data.bin"))
+    ...
+
+As the bar reaches each `window` of the file, the kernel is asked to read
+the next one ahead (MADV_WILLNEED) and to drop the ones behind
+(MADV_DONTNEED), so that resident memory stays at a few windows however
+large the file is.
+*/
+
+#include <cerrno>        // errno
+#include <cstddef>       // size_t
+#include <fcntl.h>       // open
+#include <sys/mman.h>    // mmap, madvise
+#include <sys/stat.h>    // fstat
+#include <system_error>  // system_error
+#include <type_traits>   // is_trivially_copyable
+#include <unistd.h>      // sysconf
+#include "tqdm/tqdm.h"
+
+namespace tqdm {
+
+/**
+Readahead and release for a mapping read in order, one `window` (a
+multiple of the page size) at a time.
+*/
+class MappedWindow {
+  char *base;
+  size_t len, window;
+  size_t released;  // [0, released) was given back
+
+public:
+  MappedWindow(void *base, size_t len, size_t window)
+      : base(static_cast<char *>(base)), len(len), window(window),
+        released(0) {
+    if (!len)
+      return;
+    (void)madvise(base, len, MADV_SEQUENTIAL);
+    (void)madvise(base, len < window ? len : window, MADV_WILLNEED);
+  }
+
+  size_t size() const { return window; }
+
+  /**
+   The cursor reached byte `pos`: read the following window ahead, and
+   release all but the window before the current one.
+   @return the offset at which to call again
+   */
+  size_t advance(size_t pos) {
+    size_t ahead = (pos / window + 1) * window;
+    if (ahead < len)
+      (void)madvise(base + ahead, len - ahead < window ? len - ahead : window,
+                    MADV_WILLNEED);
+    size_t keep = ahead >= 3 * window ? ahead - 3 * window : 0;
+    if (keep > released) {
+      (void)madvise(base + released, keep - released, MADV_DONTNEED);
+      released = keep;
+    }
+    return ahead;
+  }
+};
+
+/**
+`const T *` which calls MappedWindow::advance as it crosses each window.
+Only iterators made with a `window` advise; e.g. the end one does not.
+*/
+template <typename T>
+class MappedIterator
+    : public MyIteratorWrapper<const T *, MappedIterator<T>> {
+  using TQDM_IT = MyIteratorWrapper<const T *, MappedIterator>;
+  const T *first;
+  MappedWindow *window;
+  mutable const T *next_advise;
+
+  TQDM_NOINLINE void _advise() const {
+    size_t next = window->advance(size_t(
+        reinterpret_cast<const char *>(this->get()) -
+        reinterpret_cast<const char *>(first)));
+    next_advise = first + (next + sizeof(T) - 1) / sizeof(T);
+  }
+
+public:
+  MappedIterator(const T *p, const T *first, MappedWindow *window)
+      : TQDM_IT(p), first(first), window(window),
+        next_advise(window ? first + (window->size() + sizeof(T) - 1) /
+                                         sizeof(T)
+                           : nullptr) {}
+  MappedIterator(const MappedIterator &other)
+      : TQDM_IT(other.get()), first(other.first), window(other.window),
+        next_advise(other.next_advise) {}
+  MappedIterator &operator=(const MappedIterator &) = default;
+
+  void _incr() const {
+    TQDM_IT::_incr();
+    if (window && this->get() >= next_advise)
+      _advise();
+  }
+  void _advance(typename TQDM_IT::difference_type k) const {
+    TQDM_IT::_advance(k);
+    if (window && this->get() >= next_advise)
+      _advise();
+  }
+};
+
+/**
+A read-only mapping of `path` as an array of `T` (a trailing partial
+record is ignored), iterated with a bar described by `Params`.
+Throws std::system_error if the file cannot be opened or mapped.
+@param window: bytes per readahead/release step (rounded up to pages)
+*/
+template <typename T> class mapped_file {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "records are read straight from the file");
+
+  struct Mapping {
+    void *base;
+    size_t len;
+  };
+  typedef DefaultTqdm<MappedIterator<T>> bar_type;
+
+  Mapping mapping;
+  MappedWindow window;
+  bar_type bar;
+
+  static Mapping _map(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    Mapping m = {nullptr, 0};
+    if (fstat(fd, &st)) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), path);
+    }
+    m.len = size_t(st.st_size);
+    if (m.len) {
+      m.base = mmap(nullptr, m.len, PROT_READ, MAP_SHARED, fd, 0);
+      if (m.base == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+      }
+    }
+    ::close(fd);  // the mapping keeps the file
+    return m;
+  }
+  static size_t _pages(size_t bytes) {
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    return bytes ? (bytes + page - 1) / page * page : page;
+  }
+  const T *_first() const { return static_cast<const T *>(mapping.base); }
+
+public:
+  explicit mapped_file(const char *path, Params p = Params(),
+                       size_t window = 8 << 20)
+      : mapping(_map(path)),
+        window(mapping.base, mapping.len, _pages(window)),
+        bar(MappedIterator<T>(_first(), _first(), &this->window),
+            MappedIterator<T>(_first() + size(), _first(), nullptr), p) {}
+  ~mapped_file() {
+    if (mapping.base)
+      munmap(mapping.base, mapping.len);
+  }
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  const T *data() const { return _first(); }
+  size_t size() const { return mapping.len / sizeof(T); }
+
+  auto begin() -> decltype(bar.begin()) { return bar.begin(); }
+  auto end() -> decltype(bar.end()) { return bar.end(); }
+};
+
+}  // tqdm
@@ -0,0 +1,358 @@
+#pragma once
+
+/**
+Parallel loops with a single progress bar.
+
+Usage:
+  # include "tqdm/parallel.h"
+  tqdm::parallel_for(tqdm::range(n), [&](int i) { work(i); });
+  double total = tqdm::parallel_reduce(
+      tqdm::tqdm(v, p), 0.0, std::plus<double>(),
+      [](float x) { return double(x) * x; });
+  tqdm::parallel_for(v, [](float &x) { x *= 2; }, p);
+
+Any Tqdm/NoTqdm over a random-access iterator (including `range()`), or
+a random-access container, may be passed; elements are read by index
+(`begin[i]`), so no iterator state is shared between threads. Work is
+spread over a ThreadPool by work-stealing in self-tuning chunks, and
+progress goes through a single ConcurrentTqdm (one uncontended add per
+chunk). It is described by the `Params` passed, if any, else by those of
+the Tqdm passed, whose own bar is then discarded undrawn.
+*/
+
+#include <atomic>              // atomic
+#include <chrono>              // steady_clock
+#include <condition_variable>  // condition_variable
+#include <cstddef>             // size_t
+#include <exception>           // exception_ptr
+#include <functional>          // function
+#include <iterator>            // begin, end
+#include <memory>              // unique_ptr, shared_ptr
+#include <mutex>               // mutex
+#include <thread>              // thread
+#include <utility>             // pair
+#include <vector>              // vector
+#include "tqdm/tqdm.h"
+
+namespace tqdm {
+
+/**
+A fixed set of threads which all run the same job, e.g. a work-stealing
+loop. The calling thread takes part as worker 0.
+*/
+class ThreadPool {
+  std::vector<std::thread> threads;
+  std::mutex m;
+  std::condition_variable wake, idle;
+  const std::function<void(unsigned)> *job;
+  size_t generation;
+  unsigned busy;
+  bool stop;
+  std::mutex run_m;  // one `run()` at a time
+
+  static bool &_in_pool() {
+    static thread_local bool in_pool = false;
+    return in_pool;
+  }
+
+  void _worker(unsigned id) {
+    _in_pool() = true;
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lk(m);
+    for (;;) {
+      wake.wait(lk, [&] { return stop || generation != seen; });
+      if (stop)
+        return;
+      seen = generation;
+      const std::function<void(unsigned)> &fn = *job;
+      lk.unlock();
+      fn(id);
+      lk.lock();
+      if (!--busy)
+        idle.notify_all();
+    }
+  }
+
+public:
+  // @param workers: including the caller; 0 means one per hardware thread
+  explicit ThreadPool(unsigned workers = 0)
+      : job(nullptr), generation(0), busy(0), stop(false) {
+    if (!workers)
+      workers = std::thread::hardware_concurrency();
+    for (unsigned i = 1; i < workers; ++i)
+      threads.emplace_back(&ThreadPool::_worker, this, i);
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lk(m);
+      stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads)
+      t.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return unsigned(threads.size()) + 1; }
+
+  /**
+   Calls `fn(worker)` once for each worker in [0, size()), concurrently,
+   and returns when all calls have. `fn` must not throw.
+   Called from inside a job, runs all the calls in turn on this thread.
+   */
+  void run(const std::function<void(unsigned)> &fn) {
+    if (_in_pool()) {
+      for (unsigned i = 0; i < size(); ++i)
+        fn(i);
+      return;
+    }
+    std::lock_guard<std::mutex> serial(run_m);
+    {
+      std::lock_guard<std::mutex> lk(m);
+      job = &fn;
+      busy = unsigned(threads.size());
+      ++generation;
+    }
+    wake.notify_all();
+    _in_pool() = true;
+    fn(0);
+    _in_pool() = false;
+    std::unique_lock<std::mutex> lk(m);
+    idle.wait(lk, [&] { return !busy; });
+  }
+};
+
+// shared by `parallel_for` & co. unless told otherwise
+inline ThreadPool &default_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+/**
+[0, n) split evenly between workers. Each worker takes chunks from the
+front of its own share; once that is empty, it steals the back half of
+another's. Each share has its own lock, which its owner takes once per
+chunk and which is otherwise only contended by thieves.
+*/
+class StealingRanges {
+  struct Slot {
+    std::mutex m;
+    size_t lo, hi;
+    char pad[128 - (sizeof(std::mutex) + 2 * sizeof(size_t)) % 128];
+  };
+  std::unique_ptr<Slot[]> slots;
+  unsigned size;
+
+  bool _steal(unsigned thief) {
+    for (unsigned k = 1; k < size; ++k) {
+      Slot &victim = slots[(thief + k) % size];
+      size_t lo, hi;
+      {
+        std::lock_guard<std::mutex> lk(victim.m);
+        if (victim.hi - victim.lo < 2) {
+          if (victim.hi == victim.lo)
+            continue;
+          lo = victim.lo;  // last one: just take it
+        } else {
+          lo = victim.lo + (victim.hi - victim.lo) / 2;
+        }
+        hi = victim.hi;
+        victim.hi = lo;
+      }
+      Slot &own = slots[thief];
+      std::lock_guard<std::mutex> lk(own.m);
+      own.lo = lo;
+      own.hi = hi;
+      return true;
+    }
+    return false;
+  }
+
+public:
+  StealingRanges(size_t n, unsigned workers)
+      : slots(new Slot[workers ? workers : 1]), size(workers ? workers : 1) {
+    for (unsigned i = 0; i < size; ++i) {
+      slots[i].lo = n * i / size;
+      slots[i].hi = n * (i + 1) / size;
+    }
+  }
+
+  /**
+   Next chunk of at most `max` indices for `worker`, as [lo, hi).
+   @return false once there is no work left anywhere
+   */
+  bool next(unsigned worker, size_t max, size_t &lo, size_t &hi) {
+    Slot &own = slots[worker];
+    do {
+      std::lock_guard<std::mutex> lk(own.m);
+      if (own.lo != own.hi) {
+        lo = own.lo;
+        hi = own.hi - lo > max ? lo + max : own.hi;
+        own.lo = hi;
+        return true;
+      }
+    } while (_steal(worker));
+    return false;
+  }
+};
+
+// Where a Tqdm/NoTqdm is now, or all of a container.
+template <typename _Range>
+auto _begin(_Range &range, int) -> decltype(range.get()) {
+  return range.get();
+}
+template <typename _Range>
+auto _begin(_Range &range, long) -> decltype(std::begin(range)) {
+  return std::begin(range);
+}
+template <typename _Range>
+auto _count(_Range &range, int) -> decltype(size_t(range.remaining())) {
+  return size_t(range.remaining());
+}
+template <typename _Range> size_t _count(_Range &range, long) {
+  return size_t(std::end(range) - std::begin(range));
+}
+
+// A Tqdm's own bar is discarded (`parallel_chunks` shows one instead),
+// and its Params put in `p` if given.
+template <typename _Iterator, typename _Clock>
+void _hand_over(const Tqdm<_Iterator, _Clock> &range, Params *p) {
+  range.hand_over(p);
+}
+template <typename _Range> void _hand_over(const _Range &, Params *) {}
+
+template <typename _Range, typename F>
+void _parallel_chunks(_Range &range, F &body, const Params *given,
+                      ThreadPool &pool, std::chrono::microseconds target) {
+  using clock = std::chrono::steady_clock;
+  Params p = given ? *given : Params();
+  _hand_over(range, given ? nullptr : &p);
+  size_t n = _count(range, 0);
+  p.total = n;
+#ifdef TQDM_DISABLE
+  p.disable = true;
+#endif
+  if (p.f != stderr)
+    fflush(p.f);
+  std::shared_ptr<Sink> sink = shared_sink(fileno(p.f));
+  StealingRanges ranges(n, pool.size());
+  std::atomic<bool> failed(false);
+  std::exception_ptr error;
+  std::mutex error_m;
+  {
+    ConcurrentTqdm bar(p, *sink);
+    pool.run([&](unsigned worker) {
+      size_t chunk = 1, lo, hi;
+      try {
+        while (!failed.load(std::memory_order_relaxed) &&
+               ranges.next(worker, chunk, lo, hi)) {
+          clock::time_point t0 = clock::now();
+          body(worker, lo, hi);
+          bar.update(hi - lo);
+          clock::duration dt = clock::now() - t0;
+          if (dt < target / 2 && hi - lo == chunk)
+            chunk *= 2;
+          else if (dt > target * 2 && chunk > 1)
+            chunk /= 2;
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(error_m);
+        if (!error)
+          error = std::current_exception();
+        failed.store(true);
+      }
+    });
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/**
+Runs `body(worker, lo, hi)` over chunks of `range` (indices relative to
+its start) on `pool`, showing progress as described by `p`, or else by
+`range`'s own Params if it is a Tqdm. Chunks start at one item and are
+doubled or halved so that each takes about `target`, which keeps
+per-chunk overheads (a lock, a clock read, a counter add) negligible
+without starving other workers near the end. The first exception thrown
+by `body` stops all workers and is rethrown here.
+*/
+template <typename _Range, typename F>
+void parallel_chunks(_Range &&range, F body, const Params &p,
+                     ThreadPool &pool = default_pool(),
+                     std::chrono::microseconds target =
+                         std::chrono::microseconds(50)) {
+  _parallel_chunks(range, body, &p, pool, target);
+}
+template <typename _Range, typename F>
+void parallel_chunks(_Range &&range, F body,
+                     ThreadPool &pool = default_pool(),
+                     std::chrono::microseconds target =
+                         std::chrono::microseconds(50)) {
+  _parallel_chunks(range, body, nullptr, pool, target);
+}
+
+template <typename _Range, typename F>
+void _parallel_for(_Range &range, F &fn, const Params *p,
+                   ThreadPool &pool) {
+  const auto begin = _begin(range, 0);
+  auto body = [&](unsigned, size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      fn(begin[i]);
+  };
+  _parallel_chunks(range, body, p, pool, std::chrono::microseconds(50));
+}
+
+/**
+Calls `fn(begin[i])` for every element of `range` (e.g. `tqdm::range(n)`,
+`tqdm::tqdm(v)` or `v`), in parallel and in no particular order.
+*/
+template <typename _Range, typename F>
+void parallel_for(_Range &&range, F fn, const Params &p,
+                  ThreadPool &pool = default_pool()) {
+  _parallel_for(range, fn, &p, pool);
+}
+template <typename _Range, typename F>
+void parallel_for(_Range &&range, F fn, ThreadPool &pool = default_pool()) {
+  _parallel_for(range, fn, nullptr, pool);
+}
+
+template <typename _Range, typename T, typename Reduce, typename Transform>
+T _parallel_reduce(_Range &range, T init, Reduce &reduce,
+                   Transform &transform, const Params *p, ThreadPool &pool) {
+  const auto begin = _begin(range, 0);
+  // per worker: (has a value, value); only touched once per chunk
+  std::vector<std::pair<bool, T>> partial(pool.size(),
+                                          std::make_pair(false, init));
+  auto body = [&](unsigned worker, size_t lo, size_t hi) {
+    T acc = transform(begin[lo]);
+    for (size_t i = lo + 1; i < hi; ++i)
+      acc = reduce(acc, transform(begin[i]));
+    std::pair<bool, T> &mine = partial[worker];
+    mine.second = mine.first ? reduce(mine.second, acc) : acc;
+    mine.first = true;
+  };
+  _parallel_chunks(range, body, p, pool, std::chrono::microseconds(50));
+  for (const std::pair<bool, T> &part : partial)
+    if (part.first)
+      init = reduce(init, part.second);
+  return init;
+}
+
+/**
+`std::transform_reduce` over `range`, in parallel: `init` combined with
+`transform(begin[i])` for every element using `reduce`, which must be
+associative and commutative (chunks finish in no particular order).
+*/
+template <typename _Range, typename T, typename Reduce, typename Transform>
+T parallel_reduce(_Range &&range, T init, Reduce reduce, Transform transform,
+                  const Params &p, ThreadPool &pool = default_pool()) {
+  return _parallel_reduce(range, init, reduce, transform, &p, pool);
+}
+template <typename _Range, typename T, typename Reduce, typename Transform>
+T parallel_reduce(_Range &&range, T init, Reduce reduce, Transform transform,
+                  ThreadPool &pool = default_pool()) {
+  return _parallel_reduce(range, init, reduce, transform, nullptr, pool);
+}
+
+}  // tqdm
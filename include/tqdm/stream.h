@@ -0,0 +1,213 @@
+#pragma once
+
+/**
+Progress for anything read or written through a std::streambuf.
+
+Usage:
+  # include "tqdm/stream.h"
+  std::ifstream f("data.csv");
+  tqdm::istream in(f.rdbuf());  // total: the rest of the file, in bytes
+  for (std::string line; std::getline(in, line);)
+    ...
+
+Bytes are counted as the wrapped streambuf is refilled (or flushed), a
+buffer at a time, so that reading a character costs what it does with
+any other buffered stream.
+*/
+
+#include <cstring>    // memcpy
+#include <istream>    // istream
+#include <memory>     // unique_ptr
+#include <streambuf>  // streambuf
+#include "tqdm/tqdm.h"
+
+namespace tqdm {
+
+/**
+Wraps `inner`, counting bytes moved through it into a bar described by
+`Params`. Unless given, `total` is the size left from the current
+position when `inner` is seekable, and a unit left as "it" becomes
+scaled bytes. Seeking moves the bar to the new position.
+*/
+class streambuf : public std::streambuf {
+  std::streambuf *inner;
+  std::unique_ptr<char[]> buf;  // get area, then put area
+  std::streamsize size;         // of each
+  size_t n, next_print_n;
+  off_type origin;  // position of `inner` at the start, or -1
+  std::unique_ptr<Meter<>> meter;
+
+  void _count(std::streamsize k) {
+    if ((n += size_t(k)) >= next_print_n)
+      _update();
+  }
+  void _update() {
+    // SIZE_T_MAX once past `total`: stop counting
+    next_print_n = meter ? meter->update(n) : SIZE_T_MAX;
+  }
+
+  // put area -> `inner`
+  bool _flush() {
+    std::streamsize len = pptr() - pbase();
+    if (len && inner->sputn(pbase(), len) != len)
+      return false;
+    _count(len);
+    setp(buf.get() + size, buf.get() + 2 * size);
+    return true;
+  }
+
+  pos_type _moved(pos_type pos) {
+    if (pos != pos_type(off_type(-1)) && origin >= 0 &&
+        off_type(pos) >= origin) {
+      n = size_t(off_type(pos) - origin);
+      _update();
+    }
+    return pos;
+  }
+
+public:
+  explicit streambuf(std::streambuf *inner, Params p = Params(),
+                     size_t buffer_size = 1 << 16)
+      : inner(inner), buf(new char[2 * buffer_size]),
+        size(std::streamsize(buffer_size)), n(0), origin(-1) {
+    setg(buf.get(), buf.get(), buf.get());
+    setp(buf.get() + size, buf.get() + 2 * size);
+    pos_type cur =
+        inner->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+    if (cur != pos_type(off_type(-1))) {
+      origin = off_type(cur);
+      pos_type end =
+          inner->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+      inner->pubseekpos(cur, std::ios_base::in);
+      if (p.total == size_t(-1) && end != pos_type(off_type(-1)) &&
+          off_type(end) > origin)
+        p.total = size_t(off_type(end) - origin);
+    }
+    if (p.unit == "it") {
+      p.unit = "B";
+      p.unit_scale = true;
+      p.unit_divisor = 1024;
+    }
+#ifdef TQDM_DISABLE
+    p.disable = true;
+#endif
+    if (!p.disable)
+      meter.reset(new Meter<>(p));
+    next_print_n = meter ? meter->next_print_n() : SIZE_T_MAX;
+  }
+  ~streambuf() {
+    _flush();
+    inner->pubsync();
+    if (meter)
+      meter->close(n);
+  }
+
+  // bytes so far (or position, after seeking)
+  size_t count() const { return n; }
+
+protected:
+  int_type underflow() override {
+    if (gptr() == egptr()) {
+      if (!_flush())
+        return traits_type::eof();
+      std::streamsize got = inner->sgetn(buf.get(), size);
+      if (got <= 0)
+        return traits_type::eof();
+      setg(buf.get(), buf.get(), buf.get() + got);
+      _count(got);
+    }
+    return traits_type::to_int_type(*gptr());
+  }
+
+  // What is buffered first, then large reads straight into `s`.
+  std::streamsize xsgetn(char *s, std::streamsize count) override {
+    std::streamsize done = 0;
+    while (done < count) {
+      std::streamsize avail = egptr() - gptr();
+      if (avail) {
+        std::streamsize take = count - done < avail ? count - done : avail;
+        std::memcpy(s + done, gptr(), size_t(take));
+        gbump(int(take));
+        done += take;
+      } else if (count - done >= size) {
+        if (!_flush())
+          break;
+        std::streamsize got = inner->sgetn(s + done, count - done);
+        if (got <= 0)
+          break;
+        _count(got);
+        done += got;
+      } else if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+        break;
+      }
+    }
+    return done;
+  }
+
+  int_type overflow(int_type c) override {
+    if (!_flush())
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  // Small writes are buffered, large ones go straight to `inner`.
+  std::streamsize xsputn(const char *s, std::streamsize count) override {
+    if (count > epptr() - pptr()) {
+      if (!_flush())
+        return 0;
+      if (count >= size) {
+        std::streamsize put = inner->sputn(s, count);
+        _count(put > 0 ? put : 0);
+        return put;
+      }
+    }
+    std::memcpy(pptr(), s, size_t(count));
+    pbump(int(count));
+    return count;
+  }
+
+  int sync() override { return _flush() ? inner->pubsync() : -1; }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    // where we are (e.g. `tellg()`): no need to drop what is buffered
+    if (off == 0 && dir == std::ios_base::cur) {
+      pos_type pos = inner->pubseekoff(0, dir, which);
+      if (pos == pos_type(off_type(-1)))
+        return pos;
+      return pos - off_type(egptr() - gptr()) + off_type(pptr() - pbase());
+    }
+    if (!_flush())
+      return pos_type(off_type(-1));
+    if (dir == std::ios_base::cur)
+      off -= egptr() - gptr();  // `inner` is ahead by what is buffered
+    setg(buf.get(), buf.get(), buf.get());
+    return _moved(inner->pubseekoff(off, dir, which));
+  }
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    if (!_flush())
+      return pos_type(off_type(-1));
+    setg(buf.get(), buf.get(), buf.get());
+    return _moved(inner->pubseekpos(pos, which));
+  }
+};
+
+/**
+An std::istream reading through a tqdm::streambuf (see there).
+*/
+class istream : public std::istream {
+  streambuf sb;
+
+public:
+  explicit istream(std::streambuf *inner, Params p = Params())
+      : std::istream(nullptr), sb(inner, p) {
+    this->rdbuf(&sb);
+  }
+  size_t count() const { return sb.count(); }
+};
+
+}  // tqdm
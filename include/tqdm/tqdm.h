@@ -5,9 +5,6 @@ Customisable progressbar decorator for iterators.
 Includes a default range iterator printing to stderr.
 
 TODO:
-* handle s(tep) with operator+/-(=)
-* chrono and delay printing
-* class status printer
 * iterator-less: fake range iterable, update() increments value
 
 Usage:
@@ -20,26 +17,48 @@ Usage:
   //   for (int &i : tqdm::tqdm(v.begin(), v.end())
     ...
 
+Iterators without a cheap `end - begin` (e.g. std::istream_iterator) are
+not walked to count them: the total is left unknown (only the count and
+rate are shown), or `Params::total` is taken as an estimate which
+doubles whenever it is reached.
+
+Define TQDM_DISABLE before including this to compile all bars out (see
+NoTqdm); `Params::disable` turns off a single bar at runtime.
+Many bars configured alike can share one SharedParams instead of each
+copying `Params`.
+Define TQDM_CLOCK (e.g. as tqdm::CoarseClock) to change the clock bars
+read by default, or pass it to `Tqdm<_Iterator, _Clock>`.
+
 @author Casper dC-L <github.com/casperdcl>
 */
 
 #include <cassert>      // assert
+#include <cctype>       // isdigit
+#include <chrono>       // steady_clock
 #include <cinttypes>    // PRIu64
 #include <cstddef>      // ptrdiff_t, size_t
 #include <cstdint>      // int64_t
 #include <cstdio>       // printf
+#include <cstring>      // memcpy
 #include <iterator>     // iterator
 #include <limits>       // numeric_limits
+#include <memory>       // shared_ptr
+#include <mutex>        // call_once
 #include <stdexcept>    // throw
 #include <string>       // string
 #include <type_traits>  // is_pointer, ...
 #include <utility>      // swap
+#include <vector>       // vector
 #include "tqdm/utils.h"
 
 #ifndef SIZE_T_MAX
 constexpr size_t SIZE_T_MAX = std::numeric_limits<size_t>::max();
 #endif
 
+#ifndef TQDM_CLOCK
+#define TQDM_CLOCK std::chrono::steady_clock
+#endif
+
 namespace tqdm {
 
 struct Params {
@@ -54,6 +73,7 @@ struct Params {
   bool disable = false;
   std::string unit = "it";
   bool unit_scale = false;
+  unsigned unit_divisor = 1000;
   bool dynamic_ncols = false;
   float smoothing = 0.3f;
   std::string bar_format;
@@ -62,12 +82,802 @@ struct Params {
   bool gui = false;
 };
 
-template <typename _Iterator>
-class Tqdm : public MyIteratorWrapper<_Iterator> {
+/**
+Bounded output cursor used by `MeterFormat`. Numbers are written by hand
+rather than with `snprintf` (no locale lookups or format parsing per
+frame); anything past `end` is silently dropped.
+*/
+struct FmtBuf {
+  char *p, *end;
+
+  FmtBuf(char *buf, size_t len) noexcept : p(buf), end(buf + len) {}
+
+  void put(char c) noexcept {
+    if (p != end)
+      *p++ = c;
+  }
+  void put(const char *s, size_t len) noexcept {
+    if (len > size_t(end - p))
+      len = size_t(end - p);
+    std::memcpy(p, s, len);
+    p += len;
+  }
+  void fill(char c, size_t len) noexcept {
+    if (len > size_t(end - p))
+      len = size_t(end - p);
+    std::memset(p, c, len);
+    p += len;
+  }
+
+  // right-aligned in `width`, padded with `pad`
+  void put_uint(uint64_t v, unsigned width = 0, char pad = ' ') noexcept {
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    do
+      *--t = char('0' + v % 10);
+    while (v /= 10);
+    size_t len = size_t(tmp + sizeof(tmp) - t);
+    if (width > len)
+      fill(pad, width - len);
+    put(t, len);
+  }
+
+  // like "%*.*f", for `prec` <= 6 and |v| < 1e12 (larger values saturate)
+  void put_fixed(double v, unsigned prec, unsigned width = 0) noexcept {
+    static const uint64_t scales[] = {1,     10,     100,    1000,
+                                      10000, 100000, 1000000};
+    if (v != v) {  // NaN
+      if (width > 3)
+        fill(' ', width - 3);
+      put("nan", 3);
+      return;
+    }
+    bool neg = v < 0;
+    if (neg)
+      v = -v;
+    if (prec > 6)
+      prec = 6;
+    if (v > 1e12)
+      v = 1e12;
+    uint64_t scale = scales[prec], r = uint64_t(v * scale + 0.5);
+    uint64_t ip = r / scale;
+    unsigned int_len = 1;
+    for (uint64_t i = ip; i >= 10; i /= 10)
+      ++int_len;
+    unsigned len = neg + int_len + (prec ? prec + 1 : 0);
+    if (width > len)
+      fill(' ', width - len);
+    if (neg)
+      put('-');
+    put_uint(ip);
+    if (prec) {
+      put('.');
+      put_uint(r % scale, prec, '0');
+    }
+  }
+
+  // `format_sizeof`: 3 significant digits and an SI prefix, e.g. 12.3k
+  void put_sizeof(double num, const char *suffix, size_t suffix_len,
+                  unsigned divisor) noexcept {
+    static const char units[] = "kMGTPEZ";
+    for (int i = -1; i < 7; ++i) {
+      if (num < 999.5 && num > -999.5) {
+        put_fixed(num, num < 9.995 && num > -9.995
+                           ? 2
+                           : num < 99.95 && num > -99.95 ? 1 : 0);
+        if (i >= 0)
+          put(units[i]);
+        put(suffix, suffix_len);
+        return;
+      }
+      num /= divisor;
+    }
+    put_fixed(num, 1);
+    put('Y');
+    put(suffix, suffix_len);
+  }
+
+  // `format_interval`: [H:]MM:SS
+  void put_interval(double t) noexcept {
+    uint64_t s = t > 0 ? uint64_t(t) : 0, mins = s / 60, h = mins / 60;
+    if (h) {
+      put_uint(h);
+      put(':');
+    }
+    put_uint(mins % 60, 2, '0');
+    put(':');
+    put_uint(s % 60, 2, '0');
+  }
+};
+
+/**
+`format_meter`, with `Params::bar_format` compiled once into a list of ops
+so that a redraw is a single pass over them with no allocations.
+
+Supported fields (as in Python, with optional `:[width][.prec][f|d]`):
+  l_bar, bar, r_bar, desc, n, n_fmt, total, total_fmt, percentage, rate,
+  rate_fmt, elapsed, remaining, unit.
+Defaults to "{l_bar}{bar}{r_bar}", or "{desc}{n_fmt}{unit} [{elapsed},
+{rate_fmt}]" if the total is unknown.
+*/
+class MeterFormat {
+  enum Op : uint8_t {
+    LITERAL,
+    BAR,
+    N,
+    N_FMT,
+    TOTAL,
+    TOTAL_FMT,
+    PERCENTAGE,
+    RATE,
+    RATE_FMT,
+    ELAPSED,
+    REMAINING,
+  };
+  struct Item {
+    Op op;
+    uint8_t width;
+    int8_t prec;  // < 0: default
+    uint32_t off, len;  // LITERAL: slice of `text`
+  };
+  static constexpr size_t MAX_BARS = 4;
+
+public:
+  /**
+   All but `total`: `bar_format` compiled into ops, and the strings they
+   refer to. Immutable, so that bars configured alike may share one (see
+   SharedParams).
+   */
+  class Layout {
+    friend class MeterFormat;
+    std::vector<Item> ops;
+    std::string text;  // literals
+    std::string desc, unit, ascii;
+    int ncols;
+    unsigned unit_divisor;
+    bool unit_scale;
+
+    void _literal(const char *s, size_t len) {
+      if (!len)
+        return;
+      if (!ops.empty() && ops.back().op == LITERAL &&
+          ops.back().off + ops.back().len == text.size()) {
+        ops.back().len += uint32_t(len);
+      } else {
+        Item it = {LITERAL, 0, -1, uint32_t(text.size()), uint32_t(len)};
+        ops.push_back(it);
+      }
+      text.append(s, len);
+    }
+
+    void _compile(const std::string &fmt) {
+      for (size_t i = 0; i < fmt.size();) {
+        char c = fmt[i];
+        if ((c == '{' || c == '}') && i + 1 < fmt.size() &&
+            fmt[i + 1] == c) {
+          _literal(&c, 1);  // escaped brace
+          i += 2;
+          continue;
+        }
+        if (c == '}')
+          throw std::invalid_argument("bar_format: single '}'");
+        if (c != '{') {
+          size_t j = fmt.find_first_of("{}", i);
+          j = j == std::string::npos ? fmt.size() : j;
+          _literal(fmt.data() + i, j - i);
+          i = j;
+          continue;
+        }
+        size_t close = fmt.find('}', i);
+        if (close == std::string::npos)
+          throw std::invalid_argument("bar_format: unterminated '{'");
+        std::string field = fmt.substr(i + 1, close - i - 1), spec;
+        size_t colon = field.find(':');
+        if (colon != std::string::npos) {
+          spec = field.substr(colon + 1);
+          field.resize(colon);
+        }
+        _field(field, spec);
+        i = close + 1;
+      }
+    }
+
+    void _field(const std::string &name, const std::string &spec) {
+      if (name == "l_bar")
+        return _compile(ncols == 0 ? "{desc}{percentage:3.0f}%"
+                                   : "{desc}{percentage:3.0f}%|");
+      if (name == "r_bar")
+        return _compile(
+            std::string(ncols == 0 ? " " : "| ") +
+            "{n_fmt}/{total_fmt} [{elapsed}<{remaining}, {rate_fmt}]");
+      if (name == "desc")
+        return _literal(desc.data(), desc.size());
+      if (name == "unit")
+        return _literal(unit.data(), unit.size());
+
+      static const char *const names[] = {
+          nullptr, "bar",  "n",        "n_fmt",   "total",    "total_fmt",
+          "percentage", "rate", "rate_fmt", "elapsed", "remaining"};
+      Item it = {LITERAL, 0, -1, 0, 0};
+      for (uint8_t op = BAR; op <= REMAINING; ++op)
+        if (name == names[op])
+          it.op = Op(op);
+      if (it.op == LITERAL)
+        throw std::invalid_argument("bar_format: unknown field {" + name +
+                                    "}");
+      // [width][.prec][type]
+      size_t i = 0;
+      unsigned width = 0;
+      for (; i < spec.size() && isdigit((unsigned char)spec[i]); ++i)
+        width = width * 10 + unsigned(spec[i] - '0');
+      it.width = uint8_t(width < 255 ? width : 255);
+      if (i < spec.size() && spec[i] == '.') {
+        unsigned prec = 0;
+        for (++i; i < spec.size() && isdigit((unsigned char)spec[i]);
+             ++i)
+          prec = prec * 10 + unsigned(spec[i] - '0');
+        it.prec = int8_t(prec < 6 ? prec : 6);
+      }
+      if (i < spec.size() && std::strchr("fds", spec[i]))
+        ++i;
+      if (i != spec.size())
+        throw std::invalid_argument("bar_format: bad spec {" + name + ":" +
+                                    spec + "}");
+      ops.push_back(it);
+    }
+
+    void _bar(char *dst, size_t width, double frac) const noexcept {
+      size_t syms = ascii.size() - 1;  // partial blocks and a full one
+      size_t units = size_t(frac * width * syms);
+      size_t full = units / syms, part = units % syms;
+      if (full >= width) {
+        std::memset(dst, ascii[syms], width);
+        return;
+      }
+      std::memset(dst, ascii[syms], full);
+      dst[full] = ascii[part];
+      std::memset(dst + full + 1, ascii[0], width - full - 1);
+    }
+
+    // `n_fmt` and friends
+    void _count(FmtBuf &out, uint64_t v) const noexcept {
+      if (unit_scale)
+        out.put_sizeof(double(v), "", 0, unit_divisor);
+      else
+        out.put_uint(v);
+    }
+
+  public:
+    Layout(const Params &p, bool has_total)
+        : desc(p.desc.empty() ? "" : p.desc + ": "), unit(p.unit),
+          ascii(p.ascii.size() < 2 ? " #" : p.ascii), ncols(p.ncols),
+          unit_divisor(p.unit_divisor ? p.unit_divisor : 1000),
+          unit_scale(p.unit_scale) {
+      _compile(!p.bar_format.empty()
+                   ? p.bar_format
+                   : has_total
+                         ? "{l_bar}{bar}{r_bar}"
+                         : "{desc}{n_fmt}{unit} [{elapsed}, {rate_fmt}]");
+    }
+  };
+
 private:
-  using TQDM_IT = MyIteratorWrapper<_Iterator>;
+  std::shared_ptr<const Layout> layout;
+  std::atomic<size_t> total;  // may grow (see Meter), as others format
+  std::atomic<int> ncols;     // `Params::ncols`, or the terminal's
+
+public:
+  explicit MeterFormat(const Params &p)
+      : layout(std::make_shared<const Layout>(p, p.total != size_t(-1))),
+        total(p.total), ncols(p.ncols) {}
+  MeterFormat(std::shared_ptr<const Layout> layout, size_t total)
+      : layout(std::move(layout)), total(total), ncols(this->layout->ncols) {}
+
+  size_t get_total() const { return total.load(std::memory_order_relaxed); }
+  void set_total(size_t t) { total.store(t, std::memory_order_relaxed); }
+  void set_ncols(int n) { ncols.store(n, std::memory_order_relaxed); }
+
+  /**
+   Renders the meter for `n` iterations after `elapsed` seconds.
+   `rate` (iterations per second) defaults to `n / elapsed`.
+   @return number of characters written (at most `len`, not terminated)
+   */
+  size_t format(char *buf, size_t len, size_t n, float elapsed,
+                float rate = 0.0f) const noexcept {
+    if (rate <= 0.0f && elapsed > 0.0f)
+      rate = n / elapsed;
+    // shown as seconds per unit when slower than one unit per second
+    float inv_rate = rate > 0.0f && rate < 1.0f ? 1 / rate : 0.0f;
+    size_t total = get_total();
+    bool has_total = total != size_t(-1);
+    double frac = has_total && total ? double(n) / total : 0.0;
+    if (frac > 1.0)
+      frac = 1.0;
+
+    const Layout &l = *layout;
+    FmtBuf out(buf, len);
+    size_t bar_at[MAX_BARS], nbars = 0;
+    for (const Item &it : l.ops) {
+      char *start = out.p;
+      switch (it.op) {
+      case LITERAL:
+        out.put(l.text.data() + it.off, it.len);
+        break;
+      case BAR:
+        if (nbars < MAX_BARS)
+          bar_at[nbars++] = size_t(out.p - buf);
+        break;
+      case N:
+        out.put_uint(n, it.width);
+        break;
+      case N_FMT:
+        l._count(out, n);
+        break;
+      case TOTAL:
+        if (has_total)
+          out.put_uint(total, it.width);
+        else
+          out.put('?');
+        break;
+      case TOTAL_FMT:
+        if (has_total)
+          l._count(out, total);
+        else
+          out.put('?');
+        break;
+      case PERCENTAGE:
+        out.put_fixed(frac * 100, it.prec < 0 ? 6 : unsigned(it.prec),
+                      it.width);
+        break;
+      case RATE:
+        out.put_fixed(inv_rate ? inv_rate : rate,
+                      it.prec < 0 ? 6 : unsigned(it.prec), it.width);
+        break;
+      case RATE_FMT:
+        if (rate <= 0.0f)
+          out.put('?');
+        else if (l.unit_scale)
+          out.put_sizeof(inv_rate ? inv_rate : rate, "", 0,
+                         l.unit_divisor);
+        else
+          out.put_fixed(inv_rate ? inv_rate : rate, 2, 5);
+        if (inv_rate) {
+          out.put("s/", 2);
+          out.put(l.unit.data(), l.unit.size());
+        } else {
+          out.put(l.unit.data(), l.unit.size());
+          out.put("/s", 2);
+        }
+        break;
+      case ELAPSED:
+        out.put_interval(elapsed);
+        break;
+      case REMAINING:
+        if (has_total && rate > 0.0f)
+          out.put_interval(n < total ? (total - n) / rate : 0.0f);
+        else
+          out.put('?');
+        break;
+      }
+      // string fields: left-aligned
+      if (it.op != LITERAL && it.op != BAR &&
+          size_t(out.p - start) < it.width)
+        out.fill(' ', it.width - size_t(out.p - start));
+    }
+    if (!nbars)
+      return size_t(out.p - buf);
+
+    // Now that the rest is known, bars share what is left of `ncols`
+    // (or are 10 wide). Move the text after each bar out of the way,
+    // starting from the last one.
+    size_t used = size_t(out.p - buf);
+    int ncols = this->ncols.load(std::memory_order_relaxed);
+    if (ncols == 0)
+      return used;  // stats only, as in Python
+    size_t width = ncols < 0 ? 10
+                   : size_t(ncols) > used + nbars
+                       ? (size_t(ncols) - used) / nbars
+                       : 1;
+    size_t end = used + nbars * width < len ? used + nbars * width : len;
+    for (size_t b = nbars; b--;) {
+      size_t from = bar_at[b], to = from + (b + 1) * width;
+      size_t seg = (b + 1 < nbars ? bar_at[b + 1] : used) - from;
+      if (to < len)
+        std::memmove(buf + to, buf + from, seg < len - to ? seg : len - to);
+      size_t at = from + b * width;
+      if (at < len)
+        l._bar(buf + at, at + width < len ? width : len - at, frac);
+    }
+    return end;
+  }
+};
+
+/**
+`Params` frozen and reference-counted, so that bars configured alike
+(e.g. one per file or request) share a single copy of the strings and of
+the compiled `bar_format` rather than each making their own:
+
+  tqdm::SharedParams shared(p);
+  for (auto &file : files)
+    for (auto &rec : tqdm::tqdm(file.records, shared))
+      ...
+
+A default-constructed one refers to the (static) default `Params`, and
+allocates nothing.
+*/
+class SharedParams {
+  struct State {
+    Params p;
+    // [has_total]: compiled on first use, as most bars only need one
+    mutable std::once_flag compiled[2];
+    mutable std::unique_ptr<const MeterFormat::Layout> layouts[2];
+
+    explicit State(const Params &p) : p(p) {}
+  };
+  std::shared_ptr<const State> s;  // null: the defaults
+
+  const State &_state() const {
+    static const State defaults{Params()};
+    return s ? *s : defaults;
+  }
+
+public:
+  SharedParams() {}
+  SharedParams(const Params &p) : s(std::make_shared<const State>(p)) {}
+
+  const Params &operator*() const { return _state().p; }
+  const Params *operator->() const { return &_state().p; }
+
+  /**
+   The compiled `bar_format` for a bar of `total` iterations (only
+   whether it is known matters). Throws std::invalid_argument if
+   `bar_format` is malformed.
+   */
+  std::shared_ptr<const MeterFormat::Layout> layout(size_t total) const {
+    const State &st = _state();
+    bool has_total = total != size_t(-1);
+    size_t i = st.p.bar_format.empty() && has_total;
+    std::call_once(st.compiled[i], [&st, i, has_total] {
+      st.layouts[i].reset(new MeterFormat::Layout(st.p, has_total));
+    });
+    // shares ownership of the whole State (none for the defaults)
+    return std::shared_ptr<const MeterFormat::Layout>(s,
+                                                      st.layouts[i].get());
+  }
+};
+
+/**
+Iterator-independent state of a progressbar: parameters, timing and
+throttling. None of it is touched unless a redraw may be due.
+
+`total` may be unknown (`size_t(-1)`): only the count and rate are then
+shown. An `estimated` one doubles whenever it is reached, rather than
+closing the bar.
+*/
+template <typename _Clock = TQDM_CLOCK> class Meter : public AbstractLine {
+  using clock = _Clock;
+  using time_point = typename _Clock::time_point;
+  // hot: all `update()` reads, together
+  size_t total;
+  size_t last_print_n;
+  float miniters, mininterval, maxinterval, smoothing;
+  float avg_time;  // seconds per iteration (EMA), 0 if unknown
+  bool dynamic_miniters;
+  bool estimated;  // `total`
+  size_t final_n;  // furthest `reached()`
+  time_point start_t;
+  time_point last_print_t;
+  Sink *sink;
+  // cold: configuration, shared with other bars made from the same one
+  SharedParams self;  // ha, ha
+  MeterFormat fmt;
+  // `Params::f`'s, shared with other bars on the same fd (see shared_sink)
+  std::shared_ptr<Sink> sink_ref;
+  // what to show, for `format()` (which other threads' redraws may call)
+  std::atomic<size_t> shown_n;
+  std::atomic<float> shown_elapsed, shown_rate;
+
+  // either `step` (default `miniters`) after `from`, or upon completion,
+  // whichever is sooner
+  size_t _schedule(size_t from) const {
+    return _schedule(from, size_t(miniters));
+  }
+  size_t _schedule(size_t from, size_t step) const {
+    size_t next = from + (step ? step : 1);
+    return next > total || next < from ? total : next;
+  }
+
+  void _fit_width() {
+    int cols = sink->width();
+    if (cols > 0)
+      fmt.set_ncols(cols);
+  }
+
+  // redraws this bar, along with any other dirty ones in the same Sink
+  void _print(size_t n) noexcept {
+    shown_n.store(n, std::memory_order_relaxed);
+    shown_elapsed.store(
+        std::chrono::duration<float>(clock::now() - start_t).count(),
+        std::memory_order_relaxed);
+    shown_rate.store(avg_time > 0.0f ? 1 / avg_time : 0.0f,
+                     std::memory_order_relaxed);
+    this->mark_dirty();
+    sink->render();
+  }
+
+public:
+  /**
+   A bar of `total` iterations (whatever `p->total` says), configured by
+   `p`, whose strings are not copied.
+   */
+  Meter(const SharedParams &p, size_t total, bool estimated = false)
+      : total(total), last_print_n(0), mininterval(p->mininterval),
+        maxinterval(p->maxinterval), smoothing(p->smoothing),
+        avg_time(0.0f), estimated(estimated), final_n(0), self(p),
+        fmt(p.layout(total), total), shown_n(0), shown_elapsed(0.0f),
+        shown_rate(0.0f) {
+    if (p->f != stderr)
+      fflush(p->f);
+    sink_ref = shared_sink(fileno(p->f));
+    sink = sink_ref.get();
+    sink->add_line(this, p->position);
+    // `ncols` unspecified: as wide as the terminal, if it is one
+    if (p->ncols < 0 || p->dynamic_ncols)
+      _fit_width();
+    // `miniters` unspecified: adjust automatically to the iteration rate
+    dynamic_miniters = p->miniters == unsigned(-1);
+    miniters = dynamic_miniters ? 0.0f : float(p->miniters);
+    if (!dynamic_miniters)
+      mininterval = 0.0f;
+    start_t = last_print_t = clock::now();
+  }
+  explicit Meter(const Params &p) : Meter(SharedParams(p), p.total) {}
+
+  ~Meter() {
+    if (!this->is_attached())
+      return;
+    // stopped early, or the total was not known: show where
+    if (final_n > last_print_n)
+      last_print_n = final_n;
+    _close();
+  }
+  Meter(const Meter &) = delete;
+  Meter &operator=(const Meter &) = delete;
+
+  // as given (so `total` may differ)
+  const Params &params() const { return *self; }
+
+  // Takes the bar off its Sink, as it is (or erased if it was drawn),
+  // e.g. when another line is to show the same progress instead.
+  void discard() {
+    if (this->is_attached())
+      sink->drop_line(this);
+  }
+
+  size_t format(char *buf, size_t len) override {
+    if (self->dynamic_ncols)
+      _fit_width();  // cached by the sink until resized
+    return fmt.format(buf, len, shown_n.load(std::memory_order_relaxed),
+                      shown_elapsed.load(std::memory_order_relaxed),
+                      shown_rate.load(std::memory_order_relaxed));
+  }
+  bool fits_width() const override {
+    return self->ncols < 0 || self->dynamic_ncols;
+  }
+  bool stats(LineStats &st) override {
+    st.desc = self->desc.data();
+    st.desc_len = self->desc.size();
+    st.n = shown_n.load(std::memory_order_relaxed);
+    st.total = fmt.get_total();
+    st.elapsed = shown_elapsed.load(std::memory_order_relaxed);
+    st.rate = st.elapsed > 0.0f ? st.n / st.elapsed : 0.0f;
+    st.ema_rate = shown_rate.load(std::memory_order_relaxed);
+    return true;
+  }
+  void write(int fd) override {
+    char buf[1024];
+    if (write_harder(fd, buf, this->format(buf, sizeof(buf))))
+      this->not_dirty();
+  }
+
+private:
+  void _close() noexcept {
+    _print(last_print_n);
+    sink->remove_line(this, self->leave);
+  }
+
+public:
+  // Stops at `n` (e.g. short of `total`), showing it one last time.
+  void close(size_t n) noexcept {
+    if (!this->is_attached())
+      return;  // already reached `total`
+    last_print_n = n;
+    _close();
+  }
+
+  // The count got to `n` without `update()` being due, e.g. a loop which
+  // ended short of an unknown `total`: shown if the bar is destroyed.
+  void reached(size_t n) noexcept {
+    if (n > final_n)
+      final_n = n;
+  }
+
+  // @return first `n` at which `update()` needs to be called
+  size_t next_print_n() const { return _schedule(0); }
+
+  /**
+   To be called once the iteration count reaches `next_print_n`.
+   Prints if `mininterval` has elapsed since the last print.
+   @return next `n` at which to call `update()` again: SIZE_T_MAX once
+   `total` is reached (and the bar closed), or the bar was closed
+   already. Never throws: an exception edge in the caller's loop would
+   make the compiler spill its loop-carried registers.
+   */
+  size_t update(size_t n) noexcept {
+    if (!this->is_attached())
+      return SIZE_T_MAX;  // closed already
+    if (n >= total) {
+      if (!estimated) {
+        last_print_n = n;
+        _close();
+        return SIZE_T_MAX;
+      }
+      // geometric growth: O(log n) of these, however long it goes on
+      while (total <= n && total < SIZE_T_MAX - 1)
+        total = total > SIZE_T_MAX / 2 ? SIZE_T_MAX - 1
+                                       : total ? 2 * total : 1;
+      fmt.set_total(total);
+    }
+
+    if (n <= last_print_n)  // moved backwards (operator-=)
+      return _schedule(n);
+
+    // We check the counter first, to reduce the overhead of now()
+    time_point cur_t = clock::now();
+    float delta_t =
+        std::chrono::duration<float>(cur_t - last_print_t).count();
+    size_t delta_it = n - last_print_n;
+    if (delta_t < mininterval) {
+      // Too early. Rather than reading the clock on every iteration until
+      // `mininterval` has passed, extrapolate the current rate (but don't
+      // skip more than `delta_it` iterations).
+      float eta = delta_t > 0.0f
+                      ? delta_it * (mininterval - delta_t) / delta_t
+                      : float(delta_it);
+      return _schedule(n, eta < delta_it ? size_t(eta) : delta_it);
+    }
+    // EMA (not just overall average)
+    if (smoothing > 0.0f && delta_t > 0.0f)
+      avg_time = avg_time == 0.0f ? delta_t / delta_it
+                                  : smoothing * delta_t / delta_it +
+                                        (1 - smoothing) * avg_time;
+
+    _print(n);
+
+    // If no `miniters` was specified, adjust automatically to the
+    // maximum iteration rate seen so far.
+    if (dynamic_miniters) {
+      if (maxinterval > 0.0f && delta_t > maxinterval)
+        miniters = miniters * maxinterval / delta_t;
+      else if (mininterval > 0.0f && delta_t > 0.0f)
+        miniters = smoothing * delta_it * mininterval / delta_t +
+                   (1 - smoothing) * miniters;
+      else
+        miniters = smoothing * delta_it + (1 - smoothing) * miniters;
+    }
+
+    // Store old values for next call
+    last_print_n = n;
+    last_print_t = cur_t;
+    return _schedule(n);
+  }
+};
+
+/**
+Iterates over a Tqdm (or NoTqdm) `k` elements at a time, as `Block`s of
+raw iterators, advancing the bar once per block. Tight inner loops over
+each block can then be vectorised while progress is still reported:
+
+  for (auto block : tqdm::tqdm(v).chunks(4096))
+    for (float x : block)
+      sum += x;
+*/
+template <typename _Tqdm> class Chunks {
+  using raw_iterator = typename std::decay<decltype(
+      std::declval<const _Tqdm &>().get())>::type;
+  _Tqdm it;
+  size_t k;
+
+public:
+  struct Block {
+    raw_iterator b, e;
+    raw_iterator begin() const { return b; }
+    raw_iterator end() const { return e; }
+    size_t size() const { return size_t(e - b); }
+  };
+
+  class iterator {
+    _Tqdm *it;
+    size_t k;
+
+    size_t _size() const {
+      size_t left = it->remaining();
+      return left < k ? left : k;
+    }
+
+  public:
+    iterator(_Tqdm *it, size_t k) : it(it), k(k) {}
+    Block operator*() const {
+      Block block = {it->get(), it->get() + _size()};
+      return block;
+    }
+    iterator &operator++() {
+      *it += typename _Tqdm::difference_type(_size());
+      return *this;
+    }
+    // only use as (it != end)
+    bool operator!=(const iterator &) const { return bool(*it); }
+  };
+
+  Chunks(const _Tqdm &it, size_t k) : it(it), k(k ? k : 1) {}
+  iterator begin() { return iterator(&it, k); }
+  iterator end() { return iterator(nullptr, k); }
+};
+
+template <typename _Iterator, typename _Clock = TQDM_CLOCK>
+class Tqdm : public MyIteratorWrapper<_Iterator, Tqdm<_Iterator, _Clock>> {
+private:
+  using TQDM_IT = MyIteratorWrapper<_Iterator, Tqdm>;
   _Iterator e;  // end
-  Params self;  // ha, ha
+
+  /** `n` and `next_print_n` are all `_incr()` looks at unless it is time
+   to (maybe) print. `meter` lives elsewhere and never sees `this`, so that
+   the compiler can keep the former in registers. Copies (e.g. the one
+   made by range-based for loops) share the same `meter`.
+   */
+  mutable size_t n;
+  mutable size_t next_print_n;
+  std::shared_ptr<Meter<_Clock>> meter;
+
+  /** `end - begin` when that is cheap (random access), else unknown:
+   never a pass over the range just to count it, which for input
+   iterators (e.g. std::istream_iterator) would consume it
+   */
+  static size_t _distance(const _Iterator &begin, const _Iterator &end,
+                          std::random_access_iterator_tag) {
+    return size_t(end - begin);
+  }
+  static size_t _distance(const _Iterator &, const _Iterator &,
+                          std::input_iterator_tag) {
+    return size_t(-1);
+  }
+  static size_t _distance(const _Iterator &begin, const _Iterator &end) {
+    return _distance(
+        begin, end,
+        typename std::iterator_traits<_Iterator>::iterator_category());
+  }
+  // containers which know their size (e.g. std::list), or as above
+  template <typename _Container>
+  static auto _size(_Container &v, int) -> decltype(size_t(v.size())) {
+    return size_t(v.size());
+  }
+  template <typename _Container>
+  static size_t _size(_Container &v, long) {
+    return _distance(std::begin(v), std::end(v));
+  }
+
+  /** `Params::disable`: no meter.
+   An unknown `total` is taken from `p->total` if given there, as an
+   estimate which grows if need be (see Meter).
+   */
+  void _init(const SharedParams &p, size_t total) {
+    bool estimated = total == size_t(-1) && p->total != size_t(-1);
+    if (estimated)
+      total = p->total;
+    if (!p->disable)
+      meter = std::make_shared<Meter<_Clock>>(p, total, estimated);
+    next_print_n = meter ? meter->next_print_n() : SIZE_T_MAX;
+  }
 
 public:
   /**
@@ -78,20 +888,48 @@ public:
   Tqdm &begin() { return *this; }
   const Tqdm &begin() const { return *this; }
   // virtual _Iterator end() { return e; }
-  Tqdm end() const { return Tqdm(e, e); }
+
+  /** end-of-range marker: holds nothing but the end iterator, so that
+   `it != it.end()` is a plain iterator comparison
+   */
+  struct sentinel {
+    _Iterator e;
+  };
+
+private:
+  explicit Tqdm(sentinel s)
+      : TQDM_IT(s.e), e(s.e), n(0), next_print_n(SIZE_T_MAX), meter() {}
+
+public:
+#if defined(__cpp_range_based_for) && __cpp_range_based_for >= 201603L
+  // C++17: range-based for loops allow different begin/end types
+  sentinel end() const { return sentinel{e}; }
+#else
+  // C++11: range-based for loops need a `Tqdm`, so make one without a
+  // `meter` (nothing allocated, no clock read)
+  Tqdm end() const { return Tqdm(sentinel{e}); }
+#endif
+
+  using TQDM_IT::operator==;
+  using TQDM_IT::operator!=;
+  bool operator==(const sentinel &s) const { return this->get() == s.e; }
+  bool operator!=(const sentinel &s) const { return this->get() != s.e; }
 
   explicit operator _Iterator() { return this->get(); }
 
-  /** constructors
+  /** constructors: `Params` convert to SharedParams (and are copied once,
+   for this bar only)
    */
-  explicit Tqdm(_Iterator begin, _Iterator end)
-      : TQDM_IT(begin), e(end), self() {
-    self.total = size_t(end - begin);
+  explicit Tqdm(_Iterator begin, _Iterator end,
+                const SharedParams &p = SharedParams())
+      : TQDM_IT(begin), e(end), n(0) {
+    _init(p, _distance(begin, end));
   }
 
-  explicit Tqdm(_Iterator begin, size_t total)
-      : TQDM_IT(begin), e(begin + total), self() {
-    self.total = total;
+  explicit Tqdm(_Iterator begin, size_t total,
+                const SharedParams &p = SharedParams())
+      : TQDM_IT(begin), e(begin + total), n(0) {
+    _init(p, total);
   }
 
   // Tqdm(const Tqdm& other)
@@ -105,67 +943,280 @@ public:
   template <typename _Container,
             typename = typename std::enable_if<
                 !std::is_same<_Container, Tqdm>::value>::type>
-  Tqdm(_Container &v) : TQDM_IT(std::begin(v)), e(std::end(v)), self() {
-    self.total = e - this->get();
+  Tqdm(_Container &v, const SharedParams &p = SharedParams())
+      : TQDM_IT(std::begin(v)), e(std::end(v)), n(0) {
+    _init(p, _size(v, 0));
+  }
+
+  Tqdm(const Tqdm &) = default;
+  Tqdm(Tqdm &&) = default;
+  Tqdm &operator=(const Tqdm &) = default;
+  Tqdm &operator=(Tqdm &&) = default;
+  // The copy which went furthest (e.g. the one a range-based for loop
+  // increments) has the final count, for a bar with no known end.
+  ~Tqdm() {
+    if (meter)
+      meter->reached(n);
   }
 
   explicit operator bool() const { return this->get() != e; }
 
   /** TODO: magic methods */
-  virtual void _incr() const override {
-    if (this->get() == e)
-      throw std::out_of_range(
-          "exhausted");  // TODO: don't throw, just double total
-
+  // Called by TQDM_IT::operator++ (CRTP, no virtual dispatch).
+  // The common case (no redraw due) costs an add and a compare.
+  void _incr() const {
+    if (++n >= next_print_n)
+      next_print_n = meter ? meter->update(n) : SIZE_T_MAX;
     TQDM_IT::_incr();
-    if (this->get() == e) {
-      printf("\nfinished: %" PRIu64 "/%" PRIu64 "\n",
-        static_cast<std::uint64_t>(self.total),
-        static_cast<std::uint64_t>(self.total));
-    } else
-      printf("\r%" PRIi64 " left", (int64_t)(e - this->get()));
-  }
-  virtual void _incr() override { ((Tqdm const &)*this)._incr(); }
+  }
+  void _decr() const {
+    --n;
+    TQDM_IT::_decr();
+  }
+  // a jump of `k` counts as `k` iterations, checked once
+  void _advance(typename TQDM_IT::difference_type k) const {
+    if ((n += size_t(k)) >= next_print_n)
+      next_print_n = meter ? meter->update(n) : SIZE_T_MAX;
+    TQDM_IT::_advance(k);
+  }
+
+  // iterations left before `end()`
+  size_t remaining() const { return size_t(e - this->get()); }
+  Chunks<Tqdm> chunks(size_t k) const { return Chunks<Tqdm>(*this, k); }
+
+  /** For whatever shows this bar's progress instead (e.g. `parallel_for`'s
+   ConcurrentTqdm): the meter (shared with all copies) is discarded, and
+   its Params copied to `p` if given (with `disable` set if there is no
+   meter).
+   */
+  void hand_over(Params *p = nullptr) const {
+    if (meter)
+      meter->discard();
+    next_print_n = SIZE_T_MAX;
+    if (p && meter)
+      *p = meter->params();
+    else if (p)
+      p->disable = true;
+  }
 };
 
-template <typename _Iterator, typename _Tqdm = Tqdm<_Iterator>>
-_Tqdm tqdm(_Iterator begin, _Iterator end) {
-  return _Tqdm(begin, end);
+/**
+Drop-in for Tqdm which does nothing: only the iterator and its end are
+kept, and `begin()`/`end()` hand out the raw iterators, so that loops over
+it compile to the bare loop. `Params` (or SharedParams) are accepted and
+ignored.
+`tqdm()` and `range()` return this when `TQDM_DISABLE` is defined, or
+when it is passed explicitly as their `_Tqdm` policy.
+*/
+template <typename _Iterator>
+class NoTqdm : public MyIteratorWrapper<_Iterator, NoTqdm<_Iterator>> {
+  using TQDM_IT = MyIteratorWrapper<_Iterator, NoTqdm<_Iterator>>;
+  _Iterator e;  // end
+
+public:
+  template <typename _Params = Params>
+  explicit NoTqdm(_Iterator begin, _Iterator end,
+                  const _Params & = _Params())
+      : TQDM_IT(begin), e(end) {}
+  template <typename _Params = Params>
+  explicit NoTqdm(_Iterator begin, size_t total, const _Params & = _Params())
+      : TQDM_IT(begin), e(begin + total) {}
+  template <typename _Container, typename _Params = Params,
+            typename = typename std::enable_if<
+                !std::is_same<_Container, NoTqdm>::value>::type>
+  NoTqdm(_Container &v, const _Params & = _Params())
+      : TQDM_IT(std::begin(v)), e(std::end(v)) {}
+
+  _Iterator begin() const { return this->get(); }
+  _Iterator end() const { return e; }
+
+  using TQDM_IT::operator==;
+  using TQDM_IT::operator!=;
+  bool operator==(const _Iterator &it) const { return this->get() == it; }
+  bool operator!=(const _Iterator &it) const { return this->get() != it; }
+
+  explicit operator _Iterator() { return this->get(); }
+  explicit operator bool() const { return this->get() != e; }
+
+  size_t remaining() const { return size_t(e - this->get()); }
+  Chunks<NoTqdm> chunks(size_t k) const { return Chunks<NoTqdm>(*this, k); }
+};
+
+#ifdef TQDM_DISABLE
+template <typename _Iterator> using DefaultTqdm = NoTqdm<_Iterator>;
+#else
+template <typename _Iterator> using DefaultTqdm = Tqdm<_Iterator>;
+#endif
+
+/**
+Each takes either `Params`, copied for the new bar only (and ignored by
+NoTqdm), or SharedParams, which many bars may share.
+*/
+template <typename _Iterator, typename _Tqdm = DefaultTqdm<_Iterator>>
+_Tqdm tqdm(_Iterator begin, _Iterator end, const Params &p) {
+  return _Tqdm(begin, end, p);
+}
+template <typename _Iterator, typename _Tqdm = DefaultTqdm<_Iterator>>
+_Tqdm tqdm(_Iterator begin, _Iterator end,
+           const SharedParams &p = SharedParams()) {
+  return _Tqdm(begin, end, p);
 }
 
-template <typename _Iterator, typename _Tqdm = Tqdm<_Iterator>>
-_Tqdm tqdm(_Iterator begin, size_t total) {
-  return _Tqdm(begin, total);
+template <typename _Iterator, typename _Tqdm = DefaultTqdm<_Iterator>>
+_Tqdm tqdm(_Iterator begin, size_t total, const Params &p) {
+  return _Tqdm(begin, total, p);
+}
+template <typename _Iterator, typename _Tqdm = DefaultTqdm<_Iterator>>
+_Tqdm tqdm(_Iterator begin, size_t total,
+           const SharedParams &p = SharedParams()) {
+  return _Tqdm(begin, total, p);
 }
 
 template <typename _Container,
-          typename _Tqdm = Tqdm<typename _Container::iterator>>
-_Tqdm tqdm(_Container &v) {
-  return _Tqdm(v);
+          typename _Tqdm = DefaultTqdm<typename _Container::iterator>>
+_Tqdm tqdm(_Container &v, const Params &p) {
+  return _Tqdm(v, p);
+}
+template <typename _Container,
+          typename _Tqdm = DefaultTqdm<typename _Container::iterator>>
+_Tqdm tqdm(_Container &v, const SharedParams &p = SharedParams()) {
+  return _Tqdm(v, p);
 }
 
-template <size_t N, typename T, typename _Tqdm = Tqdm<T *>>
-_Tqdm tqdm(T (&tab)[N]) {
-  return _Tqdm(tab, N);
+template <size_t N, typename T, typename _Tqdm = DefaultTqdm<T *>>
+_Tqdm tqdm(T (&tab)[N], const Params &p) {
+  return _Tqdm(tab, N, p);
+}
+template <size_t N, typename T, typename _Tqdm = DefaultTqdm<T *>>
+_Tqdm tqdm(T (&tab)[N], const SharedParams &p = SharedParams()) {
+  return _Tqdm(tab, N, p);
 }
 
 template <typename SizeType = int>
-using RangeTqdm = Tqdm<RangeIterator<SizeType>>;
+using RangeTqdm = DefaultTqdm<RangeIterator<SizeType>>;
 template <typename SizeType> RangeTqdm<SizeType> range(SizeType n) {
-  return RangeTqdm<SizeType>(RangeIterator<SizeType>(n),
-                             RangeIterator<SizeType>(n));
+  RangeIterator<SizeType> begin(n);
+  return RangeTqdm<SizeType>(begin, begin.end());
 }
 template <typename SizeType>
 RangeTqdm<SizeType> range(SizeType start, SizeType end) {
-  return RangeTqdm<SizeType>(RangeIterator<SizeType>(start, end),
-                             RangeIterator<SizeType>(start, end));
+  RangeIterator<SizeType> begin(start, end);
+  return RangeTqdm<SizeType>(begin, begin.end());
 }
 template <typename SizeType>
 RangeTqdm<SizeType> range(SizeType start, SizeType end, SizeType step) {
-  return RangeTqdm<SizeType>(RangeIterator<SizeType>(start, end, step),
-                             RangeIterator<SizeType>(start, end, step));
+  RangeIterator<SizeType> begin(start, end, step);
+  return RangeTqdm<SizeType>(begin, begin.end());
 }
 
+/**
+A bar which any number of threads may `update()` concurrently, e.g. while
+draining a work queue. Counts go to per-thread shards (see ShardedCounter)
+and are only merged when the owning Sink renders the line, so that
+`update()` never bounces a cache line between threads.
+
+Output goes through `sink` (whose render thread is started, ticking every
+`Params::mininterval`), rather than `Params::f`.
+
+`_Counter` may instead be a SingleWriterCounter, when only one thread
+ever calls `update()`.
+*/
+template <class _Counter = ShardedCounter>
+class BasicConcurrentTqdm : public AbstractLine {
+  using clock = std::chrono::steady_clock;
+  Params self;
+  Sink &sink;
+  _Counter counter;
+  MeterFormat fmt;
+
+  // only touched by `format()`/`stats()`, which the sink serialises
+  clock::time_point start_t, last_t;
+  size_t last_n;
+  float avg_time;  // seconds per iteration (EMA), 0 if unknown
+
+public:
+  explicit BasicConcurrentTqdm(Params p, Sink &sink = standard_sink(),
+                               unsigned shards = 0)
+      : self(p), sink(sink), counter(shards), fmt(p), last_n(0),
+        avg_time(0.0f) {
+    start_t = last_t = clock::now();
+    if (self.disable)
+      return;
+    sink.add_line(this, self.position);
+    sink.start_render_thread(_interval());
+  }
+  ~BasicConcurrentTqdm() {
+    if (self.disable)
+      return;
+    // final counts
+    this->mark_dirty();
+    sink.render();
+    sink.remove_line(this, self.leave);
+    // the last line using the render thread stops it
+    sink.release_render_thread(_interval());
+  }
+
+  void update(size_t n = 1) {
+    counter.add(n);
+    this->mark_dirty();
+  }
+  size_t count() const { return counter.sum(); }
+
+private:
+  // `mininterval`, as the render thread's tick (at least 1 ms)
+  std::chrono::milliseconds _interval() const {
+    unsigned ms =
+        self.mininterval > 0.0f ? unsigned(self.mininterval * 1000) : 0;
+    return std::chrono::milliseconds(ms ? ms : 1);
+  }
+
+  // merges the shards and updates the rate
+  // @return seconds elapsed
+  float _sample(size_t &n) {
+    n = count();
+    clock::time_point cur_t = clock::now();
+    float delta_t = std::chrono::duration<float>(cur_t - last_t).count();
+    if (n > last_n && delta_t > 0.0f) {
+      float dt_per_it = delta_t / (n - last_n);
+      // EMA (not just overall average)
+      avg_time = avg_time == 0.0f || self.smoothing <= 0.0f
+                     ? std::chrono::duration<float>(cur_t - start_t).count() /
+                           n
+                     : self.smoothing * dt_per_it +
+                           (1 - self.smoothing) * avg_time;
+      last_n = n;
+      last_t = cur_t;
+    }
+    return std::chrono::duration<float>(cur_t - start_t).count();
+  }
+
+public:
+  size_t format(char *buf, size_t len) override {
+    size_t n;
+    float elapsed = _sample(n);
+    return fmt.format(buf, len, n, elapsed,
+                      avg_time > 0.0f ? 1 / avg_time : 0.0f);
+  }
+  bool fits_width() const override {
+    return self.ncols < 0 || self.dynamic_ncols;
+  }
+  bool stats(LineStats &st) override {
+    st.desc = self.desc.data();
+    st.desc_len = self.desc.size();
+    st.elapsed = _sample(st.n);
+    st.total = self.total;
+    st.rate = st.elapsed > 0.0f ? st.n / st.elapsed : 0.0f;
+    st.ema_rate = avg_time > 0.0f ? 1 / avg_time : 0.0f;
+    return true;
+  }
+  void write(int fd) override {
+    char buf[256];
+    if (write_harder(fd, buf, this->format(buf, sizeof(buf))))
+      this->not_dirty();
+  }
+};
+typedef BasicConcurrentTqdm<> ConcurrentTqdm;
+
 }  // tqdm
 
 /** Things to port:
@@ -176,22 +1227,8 @@ class TqdmDeprecationWarning(Exception):
 ASCII_FMT = " 123456789#"
 UTF_FMT = u" " + u''.join(map(_unich, range(0x258F, 0x2587, -1)))
 class tqdm(object):
-    @staticmethod
-    def format_sizeof(num, suffix=''):
-    @staticmethod
-    def format_interval(t):
-    @staticmethod
-    def status_printer(file):
-    @staticmethod
-    def format_meter(n, total, elapsed, ncols=None, prefix='',
-                     ascii=False, unit='it', unit_scale=False, rate=None,
-                     bar_format=None):
     def __new__(cls, *args, **kwargs):
     @classmethod
-    def _get_free_pos(cls, instance=None):
-    @classmethod
-    def _decr_instances(cls, instance):
-    @classmethod
     def write(cls, s, file=sys.stdout, end="\n"):
     @classmethod
     def pandas(tclass, *targs, **tkwargs):
@@ -13,15 +13,45 @@
 
 #endif  // CUR_OS
 
-#include <cassert>      // assert
-#include <cstddef>      // ptrdiff_t, size_t
-#include <unistd.h>     // STDERR_FILENO
-#include <iterator>     // iterator
-#include <type_traits>  // is_pointer, ...
-#include <atomic>       // atomic
-#include <cstring>      // strlen
-#include <cerrno>       // EAGAIN
-#include <poll.h>       // poll
+#include <cassert>             // assert
+#include <cstddef>             // ptrdiff_t, size_t
+#include <cstdint>             // uintptr_t
+#include <unistd.h>            // STDERR_FILENO
+#include <iterator>            // iterator
+#include <type_traits>         // is_pointer, ...
+#include <atomic>              // atomic
+#include <chrono>              // milliseconds
+#include <condition_variable>  // condition_variable
+#include <csignal>             // sigaction
+#include <cstdio>              // snprintf
+#include <cstring>             // strlen
+#include <ctime>               // clock_gettime
+#include <cerrno>              // EAGAIN
+#include <fcntl.h>             // open, fcntl
+#include <map>                 // map
+#include <memory>              // unique_ptr, shared_ptr
+#include <mutex>               // mutex
+#include <poll.h>              // poll
+#include <set>                 // multiset
+#include <string>              // string
+#include <sys/ioctl.h>         // ioctl, TIOCGWINSZ
+#include <sys/mman.h>          // mmap
+#include <sys/socket.h>        // sendto
+#include <sys/un.h>            // sockaddr_un
+#include <sys/stat.h>          // fstat
+#include <thread>              // thread
+#include <vector>              // vector
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                             \
+    (defined(__x86_64__) || defined(__i386__))
+#define TQDM_X86_DISPATCH
+#include <immintrin.h>  // _mm_cmpeq_epi8, _mm256_cmpeq_epi8
+#ifdef __x86_64__
+#define TQDM_TSC
+#include <cpuid.h>      // __get_cpuid
+#include <x86intrin.h>  // __rdtsc
+#endif
+#endif
 
 /** TODO: port from python
  * colorama win
@@ -29,10 +59,12 @@
  * _is_utf(encoding)
  * _is_ascii(s)
  * _supports_unicode(file)
- * _environ_cols()
  * _sh(const char *cmd[], ...)
  */
 
+// keywords missing from MSVC < 2015
+#if defined(_MSC_VER) && _MSC_VER < 1900
+
 #ifndef constexpr
 #define constexpr static const
 #endif
@@ -45,67 +77,141 @@
 #define noexcept
 #endif
 
+#endif  // _MSC_VER < 1900
+
+#ifndef TQDM_NOINLINE
+#ifdef _MSC_VER
+#define TQDM_NOINLINE __declspec(noinline)
+#else
+#define TQDM_NOINLINE __attribute__((noinline))
+#endif
+#endif  // TQDM_NOINLINE
+
 namespace tqdm {
 
-template <typename _Iterator>
+template <typename _Iterator, typename _Derived = void>
 /**
 Wrapper for pointers and std containter iterators.
+Has the same iterator category as `_Iterator`; operators the latter lacks
+simply fail to instantiate.
+`_Derived` (CRTP) may provide its own `_incr()`, `_decr()` and
+`_advance(k)`, which are then resolved at compile time so that
+`operator++` etc. can be fully inlined.
 @author Casper da Costa-Luis
 */
-class MyIteratorWrapper
-    : public std::iterator<
-          std::forward_iterator_tag,
-          typename std::iterator_traits<_Iterator>::value_type> {
+class MyIteratorWrapper {
+  template <typename, typename> friend class MyIteratorWrapper;
+
   mutable _Iterator p;  // TODO: remove this mutable
 
 public:
-  // already done by std::iterator
+  // std::iterator is deprecated in C++17
+  typedef typename std::iterator_traits<_Iterator>::iterator_category
+      iterator_category;
+  typedef typename std::iterator_traits<_Iterator>::pointer pointer;
   typedef typename std::iterator_traits<_Iterator>::value_type value_type;
+  typedef typename std::iterator_traits<_Iterator>::difference_type
+      difference_type;
+  // `const T &` for `const T *`
+  typedef typename std::iterator_traits<_Iterator>::reference reference;
+  typedef typename std::conditional<std::is_void<_Derived>::value,
+                                    MyIteratorWrapper, _Derived>::type
+      derived_type;
+
+private:
+  derived_type &derived() { return static_cast<derived_type &>(*this); }
+  const derived_type &derived() const {
+    return static_cast<const derived_type &>(*this);
+  }
 
+public:
   explicit MyIteratorWrapper(_Iterator x) : p(x) {}
   // default construct gives end
   MyIteratorWrapper() : p(nullptr) {}
   explicit MyIteratorWrapper(const MyIteratorWrapper &mit) : p(mit.p) {}
+  MyIteratorWrapper &operator=(const MyIteratorWrapper &) = default;
 
-  // override this in Tqdm class
-  virtual void _incr() { ++p; }
-  // override this in Tqdm class
-  virtual void _incr() const { ++p; }
+  // hide these in derived_type
+  void _incr() const { ++p; }
+  void _decr() const { --p; }
+  void _advance(difference_type k) const { p += k; }
 
-  MyIteratorWrapper &operator++() {
+  derived_type &operator++() {
     // assert(this->bool() && "Out-of-bounds iterator increment");
-    _incr();
-    return *this;
+    derived()._incr();
+    return derived();
   }
-  const MyIteratorWrapper &operator++() const {
-    _incr();
-    return *this;
+  const derived_type &operator++() const {
+    derived()._incr();
+    return derived();
+  }
+  derived_type operator++(int)const {
+    derived_type tmp(derived());
+    derived()._incr();
+    return tmp;
+  }
+  derived_type &operator--() {
+    derived()._decr();
+    return derived();
   }
-  MyIteratorWrapper operator++(int)const {
-    MyIteratorWrapper tmp(*this);
-    _incr();
+  derived_type operator--(int)const {
+    derived_type tmp(derived());
+    derived()._decr();
     return tmp;
   }
-  template <class Other>
+  derived_type &operator+=(difference_type k) {
+    derived()._advance(k);
+    return derived();
+  }
+  derived_type &operator-=(difference_type k) {
+    derived()._advance(-k);
+    return derived();
+  }
+  derived_type operator+(difference_type k) const {
+    derived_type tmp(derived());
+    return tmp += k;
+  }
+  derived_type operator-(difference_type k) const {
+    derived_type tmp(derived());
+    return tmp -= k;
+  }
+  // a template, so that it is only checked for iterators which have it
+  template <typename _It = _Iterator>
+  auto operator[](difference_type k) const
+      -> decltype(std::declval<_It &>()[k]) {
+    return p[k];
+  }
+  template <class Other, class OtherDerived>
   // two-way comparison: v.begin() == v.cbegin() and vice versa
-  bool operator==(const MyIteratorWrapper<Other> &rhs) const {
+  bool operator==(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
     return p == rhs.p;
   }
-  template <class Other>
-  bool operator!=(const MyIteratorWrapper<Other> &rhs) const {
+  template <class Other, class OtherDerived>
+  bool operator!=(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
     return p != rhs.p;
   }
-  template <class Other>
-  size_t operator-(const MyIteratorWrapper<Other> &rhs) {
+  template <class Other, class OtherDerived>
+  difference_type
+  operator-(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
     return p - rhs.p;
   }
-  // template <typename = typename std::enable_if<
-  //               !std::is_const<value_type>::value>::type>
-  value_type &operator*() {
-    // assert(this->bool() && "Invalid iterator dereference!");
-    return *p;
+  template <class Other, class OtherDerived>
+  bool operator<(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
+    return p < rhs.p;
+  }
+  template <class Other, class OtherDerived>
+  bool operator>(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
+    return p > rhs.p;
+  }
+  template <class Other, class OtherDerived>
+  bool operator<=(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
+    return p <= rhs.p;
+  }
+  template <class Other, class OtherDerived>
+  bool operator>=(const MyIteratorWrapper<Other, OtherDerived> &rhs) const {
+    return p >= rhs.p;
   }
-  const value_type &operator*() const {
+  reference operator*() const {
     // assert(this->bool() && "Invalid iterator dereference!");
     return *p;
   }
@@ -147,14 +253,19 @@ _MyIteratorWrapper myIteratorWrapper(_Iterator x) {
 }
 
 template <typename IntType = int>
-class RangeIterator
-    : public std::iterator<std::forward_iterator_tag, IntType> {
+class RangeIterator {
 private:
   mutable IntType current;
   IntType total;
   IntType step;
 
 public:
+  typedef std::random_access_iterator_tag iterator_category;
+  typedef IntType value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef IntType *pointer;
+  typedef IntType &reference;
+
   RangeIterator(IntType total) : current(0), total(total), step(1) {}
   RangeIterator(IntType start, IntType total)
       : current(start), total(total), step(1) {}
@@ -162,6 +273,9 @@ public:
       : current(start), total(total), step(step) {}
   IntType &operator*() { return current; }
   const IntType &operator*() const { return current; }
+  IntType operator[](difference_type k) const {
+    return IntType(current + k * step);
+  }
   RangeIterator &operator++() {
     current += step;
     return *this;
@@ -175,22 +289,56 @@ public:
     operator++();
     return tmp;
   }
+  RangeIterator &operator--() {
+    current -= step;
+    return *this;
+  }
+  RangeIterator &operator+=(difference_type k) {
+    current = IntType(current + k * step);
+    return *this;
+  }
+  RangeIterator &operator-=(difference_type k) { return *this += -k; }
+  RangeIterator operator+(difference_type k) const {
+    RangeIterator tmp(*this);
+    return tmp += k;
+  }
+  RangeIterator operator-(difference_type k) const {
+    RangeIterator tmp(*this);
+    return tmp -= k;
+  }
   explicit operator bool() const { return current < total; }
-  size_t size_remaining() const { return (total - current) / step; }
+  // number of values left, i.e. ceil((total - current) / step)
+  size_t size_remaining() const {
+    if (!(current < total))
+      return 0;
+    size_t k = size_t((total - current) / step);
+    return current + IntType(k) * step < total ? k + 1 : k;
+  }
+  // one past the last value
+  RangeIterator end() const {
+    return *this + difference_type(size_remaining());
+  }
 
   /** here be dragons */
 
-  // only use as (it != end), not as (end != it)
+  // Equality only checks whether the range is exhausted (so that
+  // floating-point steps can't overshoot `end`): only use as (it != end),
+  // not as (end != it).
   bool operator!=(const RangeIterator &) const { return current < total; }
   bool operator==(const RangeIterator &) const { return current >= total; }
-  IntType operator-(const RangeIterator &it) const {
-    // it's used in `end - begin`, but `end` is only a sentinel
-    // so let's use `begin `to be consistent
-    return it.size_remaining();
+  // Ordering and distances are exact: `end()` is `size_remaining()`
+  // steps after `begin`.
+  bool operator<(const RangeIterator &it) const {
+    return current < it.current;
+  }
+  difference_type operator-(const RangeIterator &it) const {
+    return current >= it.current
+               ? difference_type((current - it.current) / step)
+               : -difference_type((it.current - current) / step);
   }
 };
 
-const char *_term_move_up() {
+inline const char *_term_move_up() {
   return
 #if defined(IS_WIN) && !defined(colorama)
       ""
@@ -200,7 +348,163 @@ const char *_term_move_up() {
       ;
 }
 
-static void wait_for_write(int fd) {
+inline size_t _count_byte_scalar(const char *p, size_t len, char c) {
+  size_t n = 0;
+  for (const char *end = p + len; p != end; ++p)
+    n += *p == c;
+  return n;
+}
+
+#ifdef TQDM_X86_DISPATCH
+// Byte-wise match counts are accumulated in 8-bit lanes (subtracting the
+// 0xFF compare masks) and folded with `sad` every 255 blocks.
+__attribute__((target("sse2"))) inline size_t
+_count_byte_sse2(const char *p, size_t len, char c) {
+  const __m128i needle = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+  size_t n = 0;
+  while (len >= 16) {
+    size_t blocks = len / 16 < 255 ? len / 16 : 255;
+    __m128i acc = zero;
+    for (size_t i = 0; i < blocks; ++i, p += 16)
+      acc = _mm_sub_epi8(
+          acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), needle));
+    len -= blocks * 16;
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128((__m128i *)lanes, _mm_sad_epu8(acc, zero));
+    n += lanes[0] + lanes[1];
+  }
+  return n + _count_byte_scalar(p, len, c);
+}
+
+__attribute__((target("avx2"))) inline size_t
+_count_byte_avx2(const char *p, size_t len, char c) {
+  const __m256i needle = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+  size_t n = 0;
+  while (len >= 32) {
+    size_t blocks = len / 32 < 255 ? len / 32 : 255;
+    __m256i acc = zero;
+    for (size_t i = 0; i < blocks; ++i, p += 32)
+      acc = _mm256_sub_epi8(
+          acc,
+          _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), needle));
+    len -= blocks * 32;
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256((__m256i *)lanes, _mm256_sad_epu8(acc, zero));
+    n += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  return n + _count_byte_sse2(p, len, c);
+}
+#endif  // TQDM_X86_DISPATCH
+
+/**
+Number of occurrences of `c` in `[p, p + len)`, e.g. lines in a buffer.
+Uses AVX2 or SSE2 when the CPU has them (checked once), else a plain loop.
+*/
+inline size_t count_byte(const char *p, size_t len, char c) {
+  typedef size_t (*impl_t)(const char *, size_t, char);
+#ifdef TQDM_X86_DISPATCH
+  static const impl_t impl = __builtin_cpu_supports("avx2")
+                                 ? _count_byte_avx2
+                                 : __builtin_cpu_supports("sse2")
+                                       ? _count_byte_sse2
+                                       : _count_byte_scalar;
+#else
+  static const impl_t impl = _count_byte_scalar;
+#endif
+  return impl(p, len, c);
+}
+
+/**
+Clocks for `Tqdm<_Iterator, _Clock>` (see also `TQDM_CLOCK`), trading
+resolution for a cheaper `now()` than std::chrono::steady_clock's:
+- CoarseClock: CLOCK_MONOTONIC_COARSE, which only reads a timestamp the
+  kernel updates every tick (1-4 ms); plenty for `mininterval` >= 0.1 s.
+- TscClock: the CPU's time stamp counter, scaled by a ratio measured once
+  against steady_clock.
+Both fall back to steady_clock where unsupported (see bench-clock).
+*/
+struct CoarseClock {
+  typedef std::chrono::nanoseconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<CoarseClock> time_point;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+    struct timespec ts;
+    if (!clock_gettime(CLOCK_MONOTONIC_COARSE, &ts))
+      return time_point(duration(rep(ts.tv_sec) * 1000000000 + ts.tv_nsec));
+#endif
+    return time_point(std::chrono::duration_cast<duration>(
+        std::chrono::steady_clock::now().time_since_epoch()));
+  }
+};
+
+/**
+Only uses `rdtsc` (x86-64) if the CPU reports an invariant TSC, i.e. one
+ticking at a constant rate whatever the power state; `uses_tsc()` tells.
+The first `now()` spends ~2 ms calibrating.
+*/
+struct TscClock {
+  typedef std::chrono::nanoseconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<TscClock> time_point;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept {
+#ifdef TQDM_TSC
+    const Calibration &c = _calibration();
+    if (c.ns_per_tick > 0.0)
+      return time_point(
+          c.t0 + duration(rep(double(__rdtsc() - c.tsc0) * c.ns_per_tick)));
+#endif
+    return time_point(std::chrono::duration_cast<duration>(
+        std::chrono::steady_clock::now().time_since_epoch()));
+  }
+  static bool uses_tsc() noexcept {
+    return _calibration().ns_per_tick > 0.0;
+  }
+
+private:
+  struct Calibration {
+    uint64_t tsc0;
+    duration t0;  // steady_clock time at `tsc0`
+    double ns_per_tick;  // 0 if the TSC is unusable
+  };
+
+  static const Calibration &_calibration() noexcept {
+    static const Calibration c = _calibrate();
+    return c;
+  }
+  static Calibration _calibrate() noexcept {
+    using steady = std::chrono::steady_clock;
+    Calibration c = {0, duration(0), 0.0};
+#ifdef TQDM_TSC
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+        eax < 0x80000007 ||
+        !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+        !(edx & (1u << 8)))  // invariant TSC
+      return c;
+    steady::time_point t0 = steady::now(), t1;
+    uint64_t tsc0 = __rdtsc(), tsc1;
+    do {
+      t1 = steady::now();
+      tsc1 = __rdtsc();
+    } while (t1 - t0 < std::chrono::milliseconds(2));
+    c.tsc0 = tsc0;
+    c.t0 = std::chrono::duration_cast<duration>(t0.time_since_epoch());
+    c.ns_per_tick = double(std::chrono::duration_cast<duration>(t1 - t0)
+                               .count()) /
+                    double(tsc1 - tsc0);
+#endif
+    return c;
+  }
+};
+
+inline void wait_for_write(int fd) {
   struct pollfd pfd;
   pfd.fd = fd;
   pfd.events = POLLOUT;
@@ -210,7 +514,7 @@ static void wait_for_write(int fd) {
 // Write a buffer fully or not at all.
 // If false is returned, caller may check errno to see if it's EAGAIN
 // or a real error.
-bool write_harder(int fd, const char *buf, size_t len) {
+inline bool write_harder(int fd, const char *buf, size_t len) {
   bool did_anything = false;
 
   while (len) {
@@ -233,6 +537,137 @@ bool write_harder(int fd, const char *buf, size_t len) {
   return true;
 }
 
+// One attempt at writing `buf` to a non-blocking `fd`.
+// @return bytes written, 0 if `fd` is not ready, or -1 on error
+inline ssize_t write_some(int fd, const char *buf, size_t len) {
+  for (;;) {
+    ssize_t res = ::write(fd, buf, len);
+    if (res >= 0)
+      return res;
+    if (errno != EINTR)
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  }
+}
+
+/**
+Appends to `out` what turns a terminal row showing `prev` into one
+showing `next` (both printable ASCII, one column per byte), wherever the
+cursor is on that row: each span which differs, after a cursor move (CR,
+then forward), and a clear to the end if `next` is shorter. Spans with
+fewer unchanged bytes between them than a move would take are merged.
+The cursor is left after the last byte written.
+@return false, having appended nothing, if the two are the same
+*/
+inline bool append_line_diff(std::vector<char> &out, const char *prev,
+                             size_t prev_len, const char *next, size_t len) {
+  static const size_t MERGE = 4;  // length of "\x1b[nC"
+  auto differs = [&](size_t k) {
+    return k >= prev_len || prev[k] != next[k];
+  };
+  size_t col = size_t(-1);  // unknown until the first CR
+  auto move_to = [&](size_t to) {
+    if (col > to) {
+      out.push_back('\r');
+      col = 0;
+    }
+    if (to - col <= MERGE) {  // as cheap to write what is there anyway
+      out.insert(out.end(), next + col, next + to);
+    } else {
+      char fwd[32];
+      int n = snprintf(fwd, sizeof(fwd), "\x1b[%zuC", to - col);
+      out.insert(out.end(), fwd, fwd + n);
+    }
+    col = to;
+  };
+  for (size_t i = 0; i < len;) {
+    if (!differs(i)) {
+      ++i;
+      continue;
+    }
+    size_t j = i + 1;  // end of the span, gaps of < MERGE included
+    for (size_t k = j; k < len && k < j + MERGE; ++k)
+      if (differs(k))
+        j = k + 1;
+    move_to(i);
+    out.insert(out.end(), next + i, next + j);
+    col = j;
+    i = j;
+  }
+  if (len < prev_len) {
+    move_to(len);
+    out.insert(out.end(), "\x1b[K", "\x1b[K" + 3);
+  }
+  return col != size_t(-1);
+}
+
+/**
+A counter which many threads may add to without contending for a cache
+line: each thread adds to its own padded slot, and `sum()` merges them.
+*/
+class ShardedCounter {
+  struct Slot {
+    std::atomic<size_t> n;
+    // A 128 byte stride means no two counters share a cache line (nor an
+    // adjacent-line prefetch pair), however the array happens to be aligned.
+    char pad[128 - sizeof(std::atomic<size_t>)];
+  };
+  std::unique_ptr<Slot[]> slots;
+  unsigned mask;
+
+  static unsigned _thread_id() {
+    static std::atomic<unsigned> next_id(0);
+    static thread_local unsigned id =
+        next_id.fetch_add(1, std::memory_order_relaxed);
+    return id;
+  }
+
+public:
+  // @param shards: rounded up to a power of two; 0 means one per hardware
+  //   thread
+  explicit ShardedCounter(unsigned shards = 0) {
+    if (!shards)
+      shards = std::thread::hardware_concurrency();
+    unsigned size = 1;
+    while (size < shards && size < 1024)
+      size <<= 1;
+    mask = size - 1;
+    slots.reset(new Slot[size]);
+    for (unsigned i = 0; i < size; ++i)
+      slots[i].n.store(0, std::memory_order_relaxed);
+  }
+
+  void add(size_t k) {
+    slots[_thread_id() & mask].n.fetch_add(k, std::memory_order_relaxed);
+  }
+  // Not a snapshot: concurrent `add`s may or may not be included.
+  size_t sum() const {
+    size_t total = 0;
+    for (unsigned i = 0; i <= mask; ++i)
+      total += slots[i].n.load(std::memory_order_relaxed);
+    return total;
+  }
+  unsigned shards() const { return mask + 1; }
+};
+
+/**
+ShardedCounter's interface for counts which only one thread adds to
+(while any may read them): `add` is a plain load and store, with no
+read-modify-write.
+*/
+class SingleWriterCounter {
+  std::atomic<size_t> n;
+
+public:
+  explicit SingleWriterCounter(unsigned = 0) : n(0) {}
+
+  void add(size_t k) {
+    n.store(n.load(std::memory_order_relaxed) + k,
+            std::memory_order_relaxed);
+  }
+  size_t sum() const { return n.load(std::memory_order_relaxed); }
+  unsigned shards() const { return 1; }
+};
+
 class AbstractLine;
 
 template <class Node> class AtomicList;
@@ -241,55 +676,415 @@ template <class Node> class AtomicList;
 template <class Node> class AtomicNode {
   friend class AtomicList<Node>;
 
-  std::atomic<Node *> intrusive_link_next;
-  std::atomic<Node *> intrusive_link_prev;
+  // Address of the next AtomicNode in the list, or 0 while unattached.
+  // The low bit is set once the node is being unlinked, after which the
+  // link never changes again (Harris, 2001).
+  std::atomic<uintptr_t> intrusive_link_next;
 
-  AtomicNode(Node *next, Node *prev);
+  explicit AtomicNode(AtomicNode *next);
 
 public:
   // Node is initially unattached
   AtomicNode();
   ~AtomicNode();
+
+  bool is_attached() const {
+    return intrusive_link_next.load(std::memory_order_acquire) != 0;
+  }
 };
 
-// A non-owning intrusive linked list,
-// using atomics to ensure thread- and signal- safety.
+/**
+A non-owning intrusive linked list,
+using atomics to ensure thread- and signal- safety.
+
+- `for_each` is wait-free and may be called from signal handlers.
+- `append` is lock-free.
+- `unlink` is lock-free, but then waits for traversals which may have
+  seen the node (those already in progress once it is out of the list)
+  to finish, after which the caller may destroy the node. Traversals
+  starting later are not waited for, so a steady stream of them cannot
+  hold `unlink` up. It must not be called from within `for_each`, nor
+  from a signal handler.
+
+There are no `prev` links: they cannot be kept consistent without locks,
+and lists are short enough for `unlink` to find the predecessor by
+walking from the head. `approx_tail` spares `append` most of that walk.
+*/
 template <class Node> class AtomicList {
-  AtomicNode<Node> meta;
+  typedef AtomicNode<Node> Link;
+
+  // To more easily maintain the structure, loop to itself rather than
+  // using NULL pointers.
+  Link meta;
+  std::atomic<Link *> approx_tail;
+  // Walks in progress, counted by the parity of the `epoch` they started
+  // in (epoch-based reclamation, as in userspace RCU).
+  std::atomic<unsigned> walkers[2];
+  std::atomic<unsigned> epoch;
+  std::mutex grace_lock;  // one `_synchronise()` at a time
+
+  struct WalkGuard {
+    std::atomic<unsigned> &walkers;
+    explicit WalkGuard(AtomicList &list)
+        : walkers(list.walkers[list.epoch.load() & 1]) {
+      walkers.fetch_add(1);
+    }
+    ~WalkGuard() { walkers.fetch_sub(1); }
+  };
+
+  static Link *_ptr(uintptr_t v) {
+    return reinterpret_cast<Link *>(v & ~uintptr_t(1));
+  }
+  static bool _marked(uintptr_t v) { return v & 1; }
+  static uintptr_t _val(Link *l) { return reinterpret_cast<uintptr_t>(l); }
+
+  Link *_last(Link *from);
+  void _synchronise();
 
 public:
   AtomicList();
   ~AtomicList();
 
   void append(Node *node);
+  void unlink(Node *node);
+
+  // Call `f(Node *)` on each node, in order.
+  // Nodes which are being unlinked are skipped.
+  template <class F> void for_each(F f);
+
+  bool empty() const {
+    return _ptr(meta.intrusive_link_next.load(std::memory_order_acquire)) ==
+           &meta;
+  }
 };
 
-template <class Node> AtomicNode<Node>::AtomicNode(Node *next, Node *prev) {
-  intrusive_link_next.store(next);
-  intrusive_link_prev.store(prev);
+template <class Node>
+AtomicNode<Node>::AtomicNode(AtomicNode *next)
+    : intrusive_link_next(reinterpret_cast<uintptr_t>(next)) {}
+template <class Node>
+AtomicNode<Node>::AtomicNode() : intrusive_link_next(0) {}
+template <class Node> AtomicNode<Node>::~AtomicNode() {
+  // Nodes must be unlinked before being destroyed (and preferably before
+  // the derived class is, since other threads may still be calling it).
+  assert(!this->is_attached() && "destroying a node which is in a list");
 }
-template <class Node> AtomicNode<Node>::AtomicNode() {
-  intrusive_link_next.store(nullptr);
-  intrusive_link_prev.store(nullptr);
+
+/**
+What a line shows, as numbers, for machine-readable records (see
+`SinkOptions::records`).
+*/
+struct LineStats {
+  const char *desc;
+  size_t desc_len;
+  size_t n;
+  size_t total;  // size_t(-1) if unknown
+  float elapsed;   // seconds
+  float rate;      // overall average, per second
+  float ema_rate;  // smoothed (see `Params::smoothing`), 0 if unknown
+};
+
+/**
+Layout of `SinkOptions::Records::binary` records: 64 bytes each, in host
+byte order, with `desc` truncated and NUL-padded.
+*/
+struct BinaryRecord {
+  char magic[4];  // "TQDM"
+  uint16_t version;  // 1
+  uint16_t size;     // sizeof(BinaryRecord)
+  uint64_t n;
+  uint64_t total;  // UINT64_MAX if unknown
+  double elapsed;
+  double rate;
+  double ema_rate;
+  char desc[16];
+};
+static_assert(sizeof(BinaryRecord) == 64, "BinaryRecord layout");
+
+/**
+Layout of a shared-memory export (`SinkOptions::Records::shm`): a file
+`<shm_dir>/tqdm.<pid>.<k>` holding a ShmHeader and then `slots` ShmSlots,
+one per line. Each slot is a seqlock: its writer makes `seq` odd, updates
+the fields and makes `seq` even again; a reader copies the fields and
+retries unless it saw the same even `seq` before and after. Fields are
+relaxed atomics, so this is race-free across processes, and the writer
+only does plain stores (no syscalls).
+*/
+struct ShmSlot {
+  enum State : uint64_t { EMPTY, ACTIVE, DONE };
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> state;
+  std::atomic<uint64_t> n, total;  // total: UINT64_MAX if unknown
+  std::atomic<uint64_t> elapsed, rate, ema_rate;  // bits of doubles
+  std::atomic<uint64_t> desc[9];  // NUL-padded
+};
+static_assert(sizeof(ShmSlot) == 128, "ShmSlot layout");
+
+struct ShmHeader {
+  static const uint32_t SLOTS = 64;
+  char magic[8];     // "TQDMSHM", written last
+  uint32_t version;  // 1
+  uint32_t slots;
+  int64_t pid;
+  char pad[40];
+
+  ShmSlot *slot(size_t i) {
+    return reinterpret_cast<ShmSlot *>(this + 1) + i;
+  }
+  const ShmSlot *slot(size_t i) const {
+    return reinterpret_cast<const ShmSlot *>(this + 1) + i;
+  }
+};
+static_assert(sizeof(ShmHeader) == 64, "ShmHeader layout");
+
+// A consistent copy of a ShmSlot.
+struct ShmSnapshot {
+  bool done;
+  size_t n, total;
+  double elapsed, rate, ema_rate;
+  char desc[sizeof(ShmSlot::desc)];
+};
+
+inline uint64_t _double_bits(double x) {
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  return u;
+}
+inline double _bits_double(uint64_t u) {
+  double x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+/**
+Reads `slot` (see ShmSlot), giving up if a writer seems to have died
+while holding it.
+@return false if the slot is empty (or stuck)
+*/
+inline bool shm_snapshot(const ShmSlot &slot, ShmSnapshot &out) {
+  for (int tries = 0; tries < 1000; ++tries) {
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint64_t state = slot.state.load(std::memory_order_relaxed);
+    out.done = state == ShmSlot::DONE;
+    out.n = size_t(slot.n.load(std::memory_order_relaxed));
+    uint64_t total = slot.total.load(std::memory_order_relaxed);
+    out.total = total == UINT64_MAX ? size_t(-1) : size_t(total);
+    out.elapsed = _bits_double(slot.elapsed.load(std::memory_order_relaxed));
+    out.rate = _bits_double(slot.rate.load(std::memory_order_relaxed));
+    out.ema_rate =
+        _bits_double(slot.ema_rate.load(std::memory_order_relaxed));
+    uint64_t words[9];
+    for (size_t i = 0; i < 9; ++i)
+      words[i] = slot.desc[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+      continue;
+    memcpy(out.desc, words, sizeof(out.desc));
+    out.desc[sizeof(out.desc) - 1] = '\0';
+    return state != ShmSlot::EMPTY;
+  }
+  return false;
 }
-template <class Node> AtomicNode<Node>::~AtomicNode() {}
+
+/**
+Writer side of a shared-memory export: creates and maps the file, and
+removes it again on destruction. Each line gets a slot the first time it
+is published and keeps it until it is published as done; slots are only
+reused after that. Not thread-safe (the owning Sink serialises calls).
+*/
+class ShmSegment {
+  ShmHeader *hdr;
+  size_t size;
+  char path[256];
+  const void *owner[ShmHeader::SLOTS];
+
+public:
+  explicit ShmSegment(const char *dir) : hdr(nullptr), size(0) {
+    static std::atomic<unsigned> segments(0);
+    memset(owner, 0, sizeof(owner));
+    snprintf(path, sizeof(path), "%s/tqdm.%ld.%u", dir, (long)getpid(),
+             segments.fetch_add(1));
+    int fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return;
+    size = sizeof(ShmHeader) + ShmHeader::SLOTS * sizeof(ShmSlot);
+    void *mem = MAP_FAILED;
+    if (!ftruncate(fd, off_t(size)))
+      mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+      ::unlink(path);
+      return;
+    }
+    hdr = static_cast<ShmHeader *>(mem);  // zero-filled: all slots EMPTY
+    hdr->version = 1;
+    hdr->slots = ShmHeader::SLOTS;
+    hdr->pid = int64_t(getpid());
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(hdr->magic, "TQDMSHM", 8);
+  }
+  ~ShmSegment() {
+    if (!hdr)
+      return;
+    munmap(hdr, size);
+    ::unlink(path);
+  }
+  ShmSegment(const ShmSegment &) = delete;
+  ShmSegment &operator=(const ShmSegment &) = delete;
+
+  bool ok() const { return hdr != nullptr; }
+  const char *file() const { return path; }
+
+  // @param line: any unique key; with `done`, its slot is given up
+  void publish(const void *line, const LineStats &st, bool done) {
+    size_t i = 0, free = ShmHeader::SLOTS;
+    for (; i < ShmHeader::SLOTS && owner[i] != line; ++i)
+      if (!owner[i] && free == ShmHeader::SLOTS)
+        free = i;
+    if (i == ShmHeader::SLOTS && (i = free) == ShmHeader::SLOTS)
+      return;  // all taken
+    owner[i] = done ? nullptr : line;
+
+    uint64_t words[9] = {0};
+    memcpy(words, st.desc,
+           st.desc_len < sizeof(words) - 1 ? st.desc_len : sizeof(words) - 1);
+    ShmSlot &slot = *hdr->slot(i);
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.state.store(done ? ShmSlot::DONE : ShmSlot::ACTIVE,
+                     std::memory_order_relaxed);
+    slot.n.store(st.n, std::memory_order_relaxed);
+    slot.total.store(st.total == size_t(-1) ? UINT64_MAX : st.total,
+                     std::memory_order_relaxed);
+    slot.elapsed.store(_double_bits(st.elapsed), std::memory_order_relaxed);
+    slot.rate.store(_double_bits(st.rate), std::memory_order_relaxed);
+    slot.ema_rate.store(_double_bits(st.ema_rate),
+                        std::memory_order_relaxed);
+    for (size_t w = 0; w < 9; ++w)
+      slot.desc[w].store(words[w], std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+  }
+};
+
+/**
+Reader side: maps an export read-only, e.g. for `tqdm monitor`.
+*/
+class ShmView {
+  const ShmHeader *hdr;
+  size_t size;
+
+public:
+  explicit ShmView(const char *path) : hdr(nullptr), size(0) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return;
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (!fstat(fd, &st) && size_t(st.st_size) >= sizeof(ShmHeader)) {
+      size = size_t(st.st_size);
+      mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mem == MAP_FAILED)
+      return;
+    hdr = static_cast<const ShmHeader *>(mem);
+    if (memcmp(hdr->magic, "TQDMSHM", 8) || hdr->version != 1 ||
+        size < sizeof(ShmHeader) + hdr->slots * sizeof(ShmSlot)) {
+      munmap(const_cast<ShmHeader *>(hdr), size);
+      hdr = nullptr;
+    }
+  }
+  ~ShmView() {
+    if (hdr)
+      munmap(const_cast<ShmHeader *>(hdr), size);
+  }
+  ShmView(const ShmView &) = delete;
+  ShmView &operator=(const ShmView &) = delete;
+
+  bool ok() const { return hdr != nullptr; }
+  long pid() const { return long(hdr->pid); }
+  size_t slots() const { return hdr->slots; }
+  bool snapshot(size_t i, ShmSnapshot &out) const {
+    return shm_snapshot(*hdr->slot(i), out);
+  }
+};
 
 class AbstractLine : public AtomicNode<AbstractLine> {
   friend class Sink;
 
-  struct {
-    bool dirty : 1;
-  } flags;
+  // Set by whoever changes what `format` would return, cleared by
+  // whoever outputs it. Atomic so that worker threads may update lines
+  // while a Sink's render thread outputs them.
+  std::atomic<bool> dirty;
+  // row within the owning Sink, and what it last drew there if that was
+  // printable ASCII, for `_redraw` (guarded by the Sink's render lock)
+  size_t pos;
+  std::vector<char> drawn;
+  bool drawn_ascii;
+
+  /**
+   Appends to `out` what takes this line's row, the cursor on it, from
+   what was last drawn there to `next`. Unless `full`, that is only the
+   spans which changed (see append_line_diff), which needs both to be
+   printable ASCII: the columns of anything else cannot be told from
+   its bytes.
+   @return false if nothing needed drawing
+   */
+  bool _redraw(std::vector<char> &out, const char *next, size_t len,
+               bool full) {
+    bool ascii = true;
+    for (size_t i = 0; i < len && ascii; ++i)
+      ascii = next[i] >= 0x20 && next[i] < 0x7f;
+    bool changed = true;
+    if (!full && ascii && drawn_ascii) {
+      changed = append_line_diff(out, drawn.data(), drawn.size(), next, len);
+    } else {
+      out.push_back('\r');
+      out.insert(out.end(), next, next + len);
+      out.insert(out.end(), "\x1b[K", "\x1b[K" + 3);  // clear to the end
+    }
+    if (changed) {
+      drawn.assign(next, next + len);
+      drawn_ascii = ascii;
+    }
+    return changed;
+  }
 
 public:
-  AbstractLine() : flags{} {}
+  AbstractLine() : dirty(true), pos(0), drawn_ascii(false) {}
   // Due to how vtables work, it is cheaper to *not* inline this.
   virtual ~AbstractLine(){};
 
   virtual void write(int fd) = 0;
 
+  // Render the line (without newline) into `buf`, truncating to `len`.
+  // @return number of bytes used
+  virtual size_t format(char *buf, size_t len) = 0;
+
+  // Fill in `st` (with the numbers `format` would show).
+  // @return false if the line has no such numbers, e.g. plain text
+  virtual bool stats(LineStats &st) {
+    (void)st;
+    return false;
+  }
+
+  // Whether `format` fits the line to the terminal's width (which the Sink
+  // then needs to know).
+  virtual bool fits_width() const { return false; }
+
+  bool is_dirty() const { return dirty.load(std::memory_order_acquire); }
+  void mark_dirty() {
+    // avoid bouncing the cache line when it is already set
+    if (!dirty.load(std::memory_order_relaxed))
+      dirty.store(true, std::memory_order_release);
+  }
+
 protected:
-  void not_dirty() { this->flags.dirty = false; }
+  void not_dirty() { dirty.store(false, std::memory_order_release); }
 };
 
 class StaticTextLine : public AbstractLine {
@@ -302,17 +1097,249 @@ public:
     if (ok)
       this->not_dirty();
   }
+  size_t format(char *buf, size_t len) override {
+    size_t n = strlen(this->text);
+    n = n < len ? n : len;
+    memcpy(buf, this->text, n);
+    return n;
+  }
+};
+
+/**
+A line whose count may be bumped from any thread: `update()` only does
+an atomic add and sets `dirty`. Output is left to the owning Sink.
+*/
+class CounterLine : public AbstractLine {
+  const char *desc;
+  size_t total;
+  std::atomic<size_t> n;
+
+public:
+  explicit CounterLine(const char *desc, size_t total = size_t(-1))
+      : desc(desc), total(total), n(0) {}
+
+  void update(size_t k = 1) {
+    n.fetch_add(k, std::memory_order_relaxed);
+    this->mark_dirty();
+  }
+  size_t count() const { return n.load(std::memory_order_relaxed); }
+
+  bool stats(LineStats &st) override {
+    st.desc = desc;
+    st.desc_len = strlen(desc);
+    st.n = count();
+    st.total = total;
+    st.elapsed = st.rate = st.ema_rate = 0.0f;
+    return true;
+  }
+
+  size_t format(char *buf, size_t len) override {
+    unsigned long long cur = count();
+    int res = total == size_t(-1)
+                  ? snprintf(buf, len, "%s: %llu", desc, cur)
+                  : snprintf(buf, len, "%s: %llu/%llu", desc, cur,
+                             (unsigned long long)total);
+    if (res < 0)
+      return 0;
+    return size_t(res) < len ? size_t(res) : len ? len - 1 : 0;
+  }
+  void write(int fd) override {
+    char buf[256];
+    if (write_harder(fd, buf, this->format(buf, sizeof(buf))))
+      this->not_dirty();
+  }
+};
+
+/**
+What an AggregateClient sends: the increments made since its last
+message, as a Unix datagram.
+*/
+struct DeltaMsg {
+  uint32_t magic;  // DeltaMsg::MAGIC
+  uint32_t pid;
+  uint64_t n;
+  static const uint32_t MAGIC = 0x61647174;  // "tqda", little-endian
+};
+
+/**
+Contributes to a bar drawn by another process (`tqdm aggregate`), e.g.
+from one of many short-lived workers. `update()` is a relaxed add to a
+per-thread counter (see ShardedCounter); a background thread sends the
+sum of new increments as one DeltaMsg every `interval`, without waiting
+if the aggregator is busy, and the rest is sent on destruction.
+Increments are kept (not lost) until they could be sent.
+*/
+class AggregateClient {
+  int fd;
+  struct sockaddr_un addr;
+  ShardedCounter counter;
+  size_t sent;  // only touched by `flush`
+  std::mutex flush_lock;
+  std::thread thread;
+  std::mutex thread_lock;
+  std::condition_variable thread_wake;
+  bool thread_stop;
+
+public:
+  explicit AggregateClient(
+      const char *path,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(50),
+      unsigned shards = 0)
+      : fd(::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)), counter(shards),
+        sent(0), thread_stop(false) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    thread = std::thread([this, interval] {
+      std::unique_lock<std::mutex> lock(thread_lock);
+      while (!thread_wake.wait_for(lock, interval,
+                                   [this] { return thread_stop; }))
+        flush();
+    });
+  }
+  ~AggregateClient() {
+    {
+      std::lock_guard<std::mutex> lock(thread_lock);
+      thread_stop = true;
+    }
+    thread_wake.notify_all();
+    thread.join();
+    flush(true);
+    if (fd >= 0)
+      ::close(fd);
+  }
+  AggregateClient(const AggregateClient &) = delete;
+  AggregateClient &operator=(const AggregateClient &) = delete;
+
+  void update(size_t n = 1) { counter.add(n); }
+
+  /**
+   Sends whatever was not sent yet.
+   @param wait: for room in the aggregator's queue
+   @return false if some is left (e.g. there is no aggregator)
+   */
+  bool flush(bool wait = false) {
+    std::lock_guard<std::mutex> lock(flush_lock);
+    size_t total = counter.sum();
+    if (total == sent)
+      return true;
+    DeltaMsg msg;
+    msg.magic = DeltaMsg::MAGIC;
+    msg.pid = uint32_t(getpid());
+    msg.n = total - sent;
+    if (::sendto(fd, &msg, sizeof(msg), wait ? 0 : MSG_DONTWAIT,
+                 reinterpret_cast<const struct sockaddr *>(&addr),
+                 sizeof(addr)) != ssize_t(sizeof(msg)))
+      return false;
+    sent = total;
+    return true;
+  }
+};
+
+/**
+Receiving end of AggregateClients: a Unix datagram socket bound to
+`path` (replacing a stale socket there, but not a live one), removed
+again on destruction.
+*/
+class AggregateServer {
+  int fd;
+  std::string path;
+  size_t messages;
+
+public:
+  explicit AggregateServer(const char *path)
+      : fd(::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)), path(path),
+        messages(0) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (fd >= 0 && this->path.size() < sizeof(addr.sun_path)) {
+      memcpy(addr.sun_path, path, this->path.size());
+      struct stat st;
+      if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        // left behind, unless someone is still listening on it
+        int probe = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (::connect(probe, reinterpret_cast<const struct sockaddr *>(&addr),
+                      sizeof(addr)) &&
+            errno == ECONNREFUSED)
+          ::unlink(path);
+        ::close(probe);
+      }
+      if (!::bind(fd, reinterpret_cast<const struct sockaddr *>(&addr),
+                  sizeof(addr))) {
+        // fewer clients finding the queue full; failure is harmless
+        int size = 1 << 20;
+        (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        return;
+      }
+    }
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+  }
+  ~AggregateServer() {
+    if (fd < 0)
+      return;
+    ::close(fd);
+    ::unlink(path.c_str());
+  }
+  AggregateServer(const AggregateServer &) = delete;
+  AggregateServer &operator=(const AggregateServer &) = delete;
+
+  bool ok() const { return fd >= 0; }
+  size_t received() const { return messages; }  // DeltaMsgs so far
+
+  /**
+   Waits up to `timeout` for DeltaMsgs, then takes all that are queued.
+   @return the sum of their increments
+   */
+  size_t receive(std::chrono::milliseconds timeout) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, int(timeout.count())) <= 0)
+      return 0;
+    size_t n = 0;
+    DeltaMsg msg;
+    while (::recv(fd, &msg, sizeof(msg), MSG_DONTWAIT) ==
+           ssize_t(sizeof(msg)))
+      if (msg.magic == DeltaMsg::MAGIC) {
+        n += size_t(msg.n);
+        ++messages;
+      }
+    return n;
+  }
 };
 
 struct SinkOptions {
   // Only mandatory field. Everything else can just be zeroed.
   int fd;
 
+  // Terminal size to assume, or 0 to ask `fd` (see Sink::width)
   int tty_width;
   int tty_height;
 
+  // Never wait for `fd`: frames it cannot take are dropped (see Sink).
+  bool nonblocking;
+
+  // Rather than drawing lines, write a record for each line which changed,
+  // at most every `record_interval` seconds, e.g. for logs which are not a
+  // terminal: a JSON object per line of text, or a BinaryRecord. `shm`
+  // publishes them to a ShmSegment in `shm_dir` instead, and leaves `fd`
+  // alone (see `tqdm monitor`).
+  enum class Records { none, json, binary, shm } records;
+  float record_interval;
+  const char *shm_dir;
+
+  // Redraw only the parts of lines which changed since the last frame
+  // (see AbstractLine::_redraw), rather than whole lines.
+  bool diff;
+
   // Additional options will be added in future.
-  SinkOptions(int fd) : fd(fd){};
+  SinkOptions(int fd)
+      : fd(fd), tty_width(0), tty_height(0), nonblocking(false),
+        records(Records::none), record_interval(1.0f), shm_dir("/dev/shm"),
+        diff(true){};
 };
 
 class Sink;
@@ -320,78 +1347,767 @@ class Sink;
 // This is still a win over making a single global list of AbstractLine
 // instances, since we can skip entirely any Sink which does not express
 // interest in asynchronous updates.
-static AtomicList<Sink> all_sinks;
+// (Function-local statics, here and below, are shared by all translation
+// units, where a namespace-scope `static` would give each its own.)
+inline AtomicList<Sink> &all_sinks() {
+  static AtomicList<Sink> sinks;
+  return sinks;
+}
+
+/**
+Draws a set of lines, each on its own row (its position), as one block at
+the cursor. Every frame is composed in one buffer and output with a
+single write, so that many bars updating at once neither cost a syscall
+each nor tear.
+
+With `SinkOptions::nonblocking`, `render()` never waits on a slow fd
+(an SSH session, a full pipe): a frame which was partly written is
+finished by later calls, and a frame which the fd cannot take at all is
+dropped, to be superseded by the next one. Neither does `remove_line()`:
+a line's final state is never dropped, but what the fd cannot take yet
+is queued, for later calls (or the destructor) to write out.
 
+With `SinkOptions::records`, lines are output as structured records
+instead, composed into the same reused buffer (no allocation per record),
+or published to shared memory.
+*/
 class Sink : public AtomicNode<Sink> {
   SinkOptions opts;
   AtomicList<AbstractLine> lines;
 
+  // Only used with `render_lock` held.
+  std::mutex render_lock;
+  std::vector<char> frame;
+  std::vector<char> line_buf;          // one line, as formatted
+  std::vector<AbstractLine *> by_row;  // indexed by `pos`
+  size_t shown_rows;  // rows drawn by the last frame
+  bool relayout;      // rows moved: redraw all, clear empty ones
+  std::atomic<bool> nonblocking;  // `opts.nonblocking`, as it is now
+  // non-blocking mode only
+  int out;                    // non-blocking handle on `opts.fd`
+  int out_flags;              // `opts.fd` flags to restore, or -1
+  std::vector<char> pending;  // unwritten tail of a frame
+  std::atomic<size_t> dropped;
+  // terminal size, re-read only once marked `resized` (e.g. by SIGWINCH)
+  std::atomic<bool> resized;
+  std::atomic<int> cols, rows;
+  std::atomic<size_t> size_queried;
+  std::chrono::steady_clock::time_point last_records;
+  std::unique_ptr<ShmSegment> shm;  // `Records::shm` only
+
+  // `_get_free_pos`: the lowest row not taken
+  size_t _free_pos() {
+    std::vector<bool> taken;
+    lines.for_each([&](AbstractLine *line) {
+      if (line->pos >= taken.size())
+        taken.resize(line->pos + 1);
+      taken[line->pos] = true;
+    });
+    size_t pos = 0;
+    while (pos < taken.size() && taken[pos])
+      ++pos;
+    return pos;
+  }
+
+  // The frame so far is kept; the cursor must be at the start of row 0.
+  // @param keep: in non-blocking mode, queue rather than drop (see
+  // `_write_frame`)
+  bool _render(bool keep) {
+    if (opts.records != SinkOptions::Records::none)
+      return _render_records();
+    static const size_t MAX_LINE = 1024;
+    size_t rows = 0;
+    bool fit = false;
+    lines.for_each([&](AbstractLine *line) {
+      rows = line->pos + 1 > rows ? line->pos + 1 : rows;
+      fit |= line->fits_width();
+    });
+    // no longer than the terminal is wide, lest it wrap onto the next row
+    // (only asked if a line fits it, else as last known)
+    int w = fit ? width() : _known_width();
+    size_t line_max = w > 0 && size_t(w) < MAX_LINE ? size_t(w) : MAX_LINE;
+    by_row.assign(rows, nullptr);
+    lines.for_each([&](AbstractLine *line) {
+      if (!by_row[line->pos])
+        by_row[line->pos] = line;
+    });
+
+    size_t draw_rows = rows > shown_rows ? rows : shown_rows;
+    bool any = !frame.empty();
+    for (size_t row = 0; row < draw_rows; ++row) {
+      if (row)
+        _append("\n", 1);
+      AbstractLine *line = row < rows ? by_row[row] : nullptr;
+      // clear first, so that updates racing with `format` are not lost
+      if (line && (line->dirty.exchange(false, std::memory_order_acq_rel) ||
+                   relayout)) {
+        line_buf.resize(MAX_LINE);
+        size_t len = line->format(line_buf.data(), line_max);
+        // unchanged: nothing to draw
+        any |= line->_redraw(frame, line_buf.data(), len,
+                             relayout || !opts.diff);
+      } else if (!line && relayout) {
+        _append("\r\x1b[K", 4);
+        any = true;
+      }
+    }
+    size_t prev_rows = shown_rows;
+    relayout = false;
+    shown_rows = rows;
+    if (!any)
+      return false;
+    if (draw_rows > 1) {
+      char up[32];
+      int len = snprintf(up, sizeof(up), "\r\x1b[%zuA", draw_rows - 1);
+      _append(up, size_t(len));
+    } else
+      _append("\r", 1);
+    if (_write_frame(keep))
+      return true;
+    // superseded by the next frame, which must redraw everything
+    relayout = true;
+    shown_rows = rows > prev_rows ? rows : prev_rows;
+    return false;
+  }
+
+  // Outputs `frame`. In non-blocking mode, what the fd cannot take yet is
+  // left `pending`; with `keep`, even if that is all of it (rather than
+  // dropping it), since nothing later would redraw it.
+  // @return false if it was dropped (or failed)
+  bool _write_frame(bool keep) {
+    if (!nonblocking.load(std::memory_order_relaxed))
+      return write_harder(opts.fd, frame.data(), frame.size());
+    // a frame already started has to be finished, escapes and all
+    ssize_t res =
+        _flush(false) ? write_some(out, frame.data(), frame.size()) : 0;
+    if (res < 0 || (res == 0 && !keep)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    pending.insert(pending.end(), frame.begin() + res, frame.end());
+    return true;
+  }
+
+  // `_render` for `SinkOptions::records`
+  bool _render_records() {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (last_records != std::chrono::steady_clock::time_point() &&
+        now - last_records <
+            std::chrono::duration<float>(opts.record_interval))
+      return false;  // dirty lines are kept for next time
+    bool to_shm = opts.records == SinkOptions::Records::shm;
+    bool published = false;
+    lines.for_each([&](AbstractLine *line) {
+      if (line->dirty.exchange(false, std::memory_order_acq_rel) ||
+          relayout) {
+        if (to_shm)
+          published |= _publish(line, false);
+        else
+          _append_record(line);
+      }
+    });
+    relayout = false;
+    if (to_shm) {
+      if (published)
+        last_records = now;
+      return published;
+    }
+    if (frame.empty())
+      return false;
+    last_records = now;
+    if (_write_frame(false))
+      return true;
+    relayout = true;  // next time, all lines again
+    return false;
+  }
+
+  bool _publish(AbstractLine *line, bool done) {
+    LineStats st;
+    if (!shm || !line->stats(st))
+      return false;
+    shm->publish(line, st, done);
+    return true;
+  }
+
+  void _open_shm() {
+    shm.reset(new ShmSegment(opts.shm_dir));
+    if (!shm->ok())
+      shm.reset();
+  }
+
+  void _append_record(AbstractLine *line) {
+    LineStats st;
+    if (!line->stats(st))
+      return;
+    if (opts.records == SinkOptions::Records::binary) {
+      BinaryRecord rec;
+      memset(&rec, 0, sizeof(rec));
+      memcpy(rec.magic, "TQDM", 4);
+      rec.version = 1;
+      rec.size = sizeof(rec);
+      rec.n = st.n;
+      rec.total = st.total == size_t(-1) ? UINT64_MAX : st.total;
+      rec.elapsed = st.elapsed;
+      rec.rate = st.rate;
+      rec.ema_rate = st.ema_rate;
+      memcpy(rec.desc, st.desc,
+             st.desc_len < sizeof(rec.desc) ? st.desc_len : sizeof(rec.desc));
+      _append(reinterpret_cast<const char *>(&rec), sizeof(rec));
+      return;
+    }
+    // {"desc":"...","n":1,"total":null,"elapsed":0.1,"rate":10,...}
+    char desc[256];
+    size_t d = 0;
+    for (size_t i = 0; i < st.desc_len && d + 7 < sizeof(desc); ++i) {
+      unsigned char c = (unsigned char)st.desc[i];
+      if (c == '"' || c == '\\') {
+        desc[d++] = '\\';
+        desc[d++] = char(c);
+      } else if (c < 0x20) {
+        d += size_t(snprintf(desc + d, sizeof(desc) - d, "\\u%04x", c));
+      } else {
+        desc[d++] = char(c);
+      }
+    }
+    desc[d] = '\0';
+    char total[24] = "null";
+    if (st.total != size_t(-1))
+      snprintf(total, sizeof(total), "%llu", (unsigned long long)st.total);
+    char rec[512];
+    int len = snprintf(rec, sizeof(rec),
+                       "{\"desc\":\"%s\",\"n\":%llu,\"total\":%s,"
+                       "\"elapsed\":%.3f,\"rate\":%.6g,\"ema_rate\":%.6g}\n",
+                       desc, (unsigned long long)st.n, total,
+                       double(st.elapsed), double(st.rate),
+                       double(st.ema_rate));
+    if (len > 0)
+      _append(rec, size_t(len) < sizeof(rec) ? size_t(len) : sizeof(rec) - 1);
+  }
+
+  // Writes out `pending`. @return true once it is empty
+  bool _flush(bool wait) {
+    size_t done = 0;
+    while (done < pending.size()) {
+      ssize_t res = write_some(out, &pending[done], pending.size() - done);
+      if (res > 0)
+        done += size_t(res);
+      else if (res == 0 && wait)
+        wait_for_write(out);
+      else
+        break;
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+    return pending.empty();
+  }
+
+  void _open_out() {
+    out = opts.fd;
+    out_flags = -1;
+    struct stat st;
+    if (fstat(opts.fd, &st) || S_ISREG(st.st_mode))
+      return;  // writes to files do not block for long
+#ifdef __linux__
+    // A fresh open file description, so that `opts.fd` (often shared with
+    // the shell) is not made non-blocking under everyone else's feet.
+    if (S_ISCHR(st.st_mode) || S_ISFIFO(st.st_mode)) {
+      char path[32];
+      snprintf(path, sizeof(path), "/proc/self/fd/%d", opts.fd);
+      int fd = ::open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+      if (fd >= 0) {
+        out = fd;
+        return;
+      }
+    }
+#endif
+    int flags = fcntl(opts.fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_NONBLOCK) &&
+        !fcntl(opts.fd, F_SETFL, flags | O_NONBLOCK))
+      out_flags = flags;
+  }
+  void _close_out() {
+    _flush(true);
+    if (out != opts.fd)
+      ::close(out);
+    else if (out_flags >= 0)
+      (void)fcntl(opts.fd, F_SETFL, out_flags);
+  }
+
+  std::thread render_thread;
+  std::mutex render_thread_lock;
+  std::condition_variable render_thread_wake;
+  bool render_thread_stop;
+  std::chrono::milliseconds render_interval;  // shortest asked for
+  std::multiset<std::chrono::milliseconds> render_users;
+  std::mutex render_users_lock;  // serialises starting/stopping the thread
+
+  void _render_loop() {
+    std::unique_lock<std::mutex> lock(render_thread_lock);
+    while (!render_thread_stop) {
+      std::chrono::milliseconds interval = render_interval;
+      // woken early by a stop, or a user asking for a shorter interval
+      if (render_thread_wake.wait_for(lock, interval, [&] {
+            return render_thread_stop || render_interval != interval;
+          }))
+        continue;
+      lock.unlock();
+      render();
+      lock.lock();
+    }
+    lock.unlock();
+    render();  // final frame
+  }
+  // call with `render_users_lock` held
+  void _stop_render_thread() {
+    if (!render_thread.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(render_thread_lock);
+      render_thread_stop = true;
+    }
+    render_thread_wake.notify_all();
+    render_thread.join();
+  }
+
+  void _append(const char *s, size_t len) {
+    frame.insert(frame.end(), s, s + len);
+  }
+
+  // call with `render_lock` held: rows below `line` move up
+  void _unlink_line(AbstractLine *line) {
+    lines.unlink(line);
+    frame.clear();
+    lines.for_each([&](AbstractLine *other) {
+      if (other->pos > line->pos)
+        --other->pos;
+    });
+  }
+
 public:
-  explicit Sink(SinkOptions o) : opts(o) { all_sinks.append(this); }
+  explicit Sink(SinkOptions o)
+      : opts(o), shown_rows(0), relayout(false), nonblocking(o.nonblocking),
+        out(o.fd), out_flags(-1), dropped(0), resized(true), cols(0),
+        rows(0), size_queried(0), render_thread_stop(false),
+        render_interval(100) {
+    if (nonblocking)
+      _open_out();
+    if (opts.records == SinkOptions::Records::shm)
+      _open_shm();
+    all_sinks().append(this);
+  }
   Sink(Sink &&) = delete;
   Sink &operator=(Sink &&) = delete;
+  ~Sink() {
+    stop_render_thread();
+    all_sinks().unlink(this);
+    if (nonblocking)
+      _close_out();
+  }
+
+  int fd() const { return opts.fd; }
+
+  /**
+   Columns of the terminal `fd` is (or `SinkOptions::tty_width`), or 0 if
+   it is not one. Asked (TIOCGWINSZ) once, then cached until
+   `mark_resized()`, so that redraws cost no syscall.
+   */
+  int width() {
+    if (opts.tty_width > 0)
+      return opts.tty_width;
+    _refresh_size();
+    return cols.load(std::memory_order_relaxed);
+  }
+  // Rows, as `width()`.
+  int height() {
+    if (opts.tty_height > 0)
+      return opts.tty_height;
+    _refresh_size();
+    return rows.load(std::memory_order_relaxed);
+  }
+
+  // Marks the terminal size stale, to be asked again. Async-signal-safe:
+  // all the SIGWINCH handler (see `watch_resize()`) does to each Sink.
+  void mark_resized() { resized.store(true, std::memory_order_relaxed); }
+
+  // Times the terminal was asked its size.
+  size_t size_queries() const {
+    return size_queried.load(std::memory_order_relaxed);
+  }
+
+private:
+  int _known_width() const {
+    return opts.tty_width > 0 ? opts.tty_width
+                              : cols.load(std::memory_order_relaxed);
+  }
+  void _refresh_size() {
+    if (!resized.load(std::memory_order_relaxed) ||
+        !resized.exchange(false, std::memory_order_acquire))
+      return;
+    size_queried.fetch_add(1, std::memory_order_relaxed);
+    int c = 0, r = 0;
+#ifdef TIOCGWINSZ
+    struct winsize ws;
+    if (!ioctl(opts.fd, TIOCGWINSZ, &ws)) {
+      c = ws.ws_col;
+      r = ws.ws_row;
+    }
+#endif
+    cols.store(c, std::memory_order_relaxed);
+    rows.store(r, std::memory_order_relaxed);
+  }
+
+public:
+
+  // Switches `SinkOptions::nonblocking` on or off, e.g. for `standard_sink()`.
+  void set_nonblocking(bool on) {
+    std::lock_guard<std::mutex> guard(render_lock);
+    if (on == nonblocking.load(std::memory_order_relaxed))
+      return;
+    if (on)
+      _open_out();
+    else
+      _close_out();
+    nonblocking.store(on, std::memory_order_relaxed);
+  }
+
+  // Switches `SinkOptions::records` (e.g. for `standard_sink()`).
+  void set_records(SinkOptions::Records records, float interval = 1.0f) {
+    std::lock_guard<std::mutex> guard(render_lock);
+    opts.records = records;
+    opts.record_interval = interval;
+    relayout = true;
+    if (records != SinkOptions::Records::shm)
+      shm.reset();
+    else if (!shm)
+      _open_shm();
+  }
+
+  // `Records::shm`: the file published to, or nullptr if none could be made
+  const char *shm_file() const { return shm ? shm->file() : nullptr; }
+
+  // Frames not output (non-blocking mode) because `fd` was not ready.
+  size_t dropped_frames() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+  /**
+   Lines are borrowed, and must be removed before being destroyed.
+   @param position: row to draw `line` on, or < 0 for the lowest free one
+   */
+  void add_line(AbstractLine *line, int position = -1) {
+    std::lock_guard<std::mutex> guard(render_lock);
+    line->pos = position >= 0 ? size_t(position) : _free_pos();
+    line->drawn_ascii = false;  // whatever it drew elsewhere is not here
+    lines.append(line);
+  }
+
+  /**
+   `_decr_instances`: rows below `line` move up to fill its place.
+   With `leave`, a line on the first row is left on screen as it was last
+   drawn, and the block moves down past it; otherwise it is erased.
+   With `SinkOptions::records`, the line's final record is written (or
+   published as done).
+   */
+  void remove_line(AbstractLine *line, bool leave = false) {
+    std::lock_guard<std::mutex> guard(render_lock);
+    _unlink_line(line);
+    if (opts.records == SinkOptions::Records::shm) {
+      _publish(line, true);
+      return;
+    }
+    if (opts.records != SinkOptions::Records::none) {
+      _append_record(line);  // final numbers, whatever the interval
+      if (!frame.empty())
+        _write_frame(true);
+      return;
+    }
+    if (leave && line->pos == 0) {
+      _append("\n", 1);
+      shown_rows = shown_rows ? shown_rows - 1 : 0;
+    }
+    relayout = true;
+    _render(true);
+  }
+
+  /**
+   As `remove_line`, for a line which is to be forgotten rather than
+   finished (e.g. because another line shows the same progress): no final
+   record, and it is erased if it was drawn at all.
+   */
+  void drop_line(AbstractLine *line) {
+    std::lock_guard<std::mutex> guard(render_lock);
+    _unlink_line(line);
+    if (opts.records != SinkOptions::Records::none)
+      return;
+    relayout = true;
+    _render(true);
+  }
+
+  /**
+   Output all dirty lines as a single frame, using one write.
+   Lines which are not dirty are skipped over rather than redrawn.
+   The cursor is left at the start of the first row.
+   In non-blocking mode, returns at once if another thread is rendering
+   (which leaves dirty lines for it, or the next call, to draw).
+   @return false if nothing was written (nothing dirty, or write failed)
+   */
+  bool render() {
+    std::unique_lock<std::mutex> guard(render_lock, std::defer_lock);
+    if (nonblocking.load(std::memory_order_relaxed)) {
+      if (!guard.try_lock())
+        return false;
+    } else {
+      guard.lock();
+    }
+    frame.clear();
+    // e.g. a line's final state, queued by `remove_line()`
+    if (!pending.empty())
+      _flush(false);
+    return _render(false);
+  }
+
+  /**
+   Call `render()` every `interval` from a background thread, so that
+   threads updating lines never touch the terminal themselves.
+   Each call adds a user of the thread, which then ticks at the shortest
+   `interval` of its users until the last one calls
+   `release_render_thread()`.
+   */
+  void start_render_thread(
+      std::chrono::milliseconds interval = std::chrono::milliseconds(100)) {
+    std::lock_guard<std::mutex> users(render_users_lock);
+    {
+      std::lock_guard<std::mutex> lock(render_thread_lock);
+      render_users.insert(interval);
+      render_interval = *render_users.begin();
+      render_thread_stop = false;
+    }
+    render_thread_wake.notify_all();
+    if (!render_thread.joinable())
+      render_thread = std::thread([this] { _render_loop(); });
+  }
+  // Undoes one `start_render_thread(interval)`.
+  void release_render_thread(
+      std::chrono::milliseconds interval = std::chrono::milliseconds(100)) {
+    std::lock_guard<std::mutex> users(render_users_lock);
+    {
+      std::lock_guard<std::mutex> lock(render_thread_lock);
+      std::multiset<std::chrono::milliseconds>::iterator it =
+          render_users.find(interval);
+      if (it != render_users.end())
+        render_users.erase(it);
+      if (!render_users.empty()) {
+        render_interval = *render_users.begin();
+        return;  // the thread picks the interval up at its next tick
+      }
+    }
+    _stop_render_thread();
+  }
+  // Stops the thread whoever is using it (after a final frame).
+  void stop_render_thread() {
+    std::lock_guard<std::mutex> users(render_users_lock);
+    {
+      std::lock_guard<std::mutex> lock(render_thread_lock);
+      render_users.clear();
+    }
+    _stop_render_thread();
+  }
+  bool has_render_thread() {
+    std::lock_guard<std::mutex> users(render_users_lock);
+    return render_thread.joinable();
+  }
+  std::chrono::milliseconds render_thread_interval() {
+    std::lock_guard<std::mutex> lock(render_thread_lock);
+    return render_interval;
+  }
 };
 
-Sink standard_sink(SinkOptions(STDERR_FILENO));
+// Shared by every bar drawn on stderr.
+inline Sink &standard_sink() {
+  static Sink sink(SinkOptions(STDERR_FILENO));
+  return sink;
+}
+
+/**
+The Sink which bars drawn on `fd` share, so that their positions are
+managed together: `standard_sink()` for stderr, else made by the first
+bar on `fd` and destroyed along with the last one.
+*/
+inline std::shared_ptr<Sink> shared_sink(int fd) {
+  if (fd == STDERR_FILENO)
+    return std::shared_ptr<Sink>(&standard_sink(), [](Sink *) {});
+  static std::mutex lock;
+  static std::map<int, std::weak_ptr<Sink>> sinks;
+  std::lock_guard<std::mutex> guard(lock);
+  std::weak_ptr<Sink> &weak = sinks[fd];
+  std::shared_ptr<Sink> sink = weak.lock();
+  if (!sink) {
+    sink = std::make_shared<Sink>(SinkOptions(fd));
+    weak = sink;
+  }
+  return sink;
+}
+
+#ifdef SIGWINCH
+// Constant-initialised (no guard), so safe to use from the handler.
+inline struct sigaction &_prev_winch() {
+  static struct sigaction prev;
+  return prev;
+}
+
+// Only marks each Sink's size stale (AtomicList::for_each is wait-free),
+// then passes the signal on to whichever handler was there before.
+inline void _on_winch(int sig, siginfo_t *info, void *ctx) {
+  int saved = errno;
+  all_sinks().for_each([](Sink *sink) { sink->mark_resized(); });
+  errno = saved;
+  const struct sigaction &prev = _prev_winch();
+  if (prev.sa_flags & SA_SIGINFO)
+    prev.sa_sigaction(sig, info, ctx);
+  else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN)
+    prev.sa_handler(sig);
+}
+#endif
+
+/**
+Opt-in: installs a SIGWINCH handler (once, keeping any previous handler,
+which it calls in turn), which has every Sink ask the terminal its size
+again once it has been resized. Otherwise, that only happens upon
+`Sink::mark_resized()`. Left to applications, since a library should not
+take over a process's signals unasked.
+*/
+inline void watch_resize() {
+#ifdef SIGWINCH
+  static std::once_flag once;
+  std::call_once(once, [] {
+    // built now, so that the handler never initialises it
+    all_sinks();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = _on_winch;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    (void)sigaction(SIGWINCH, &sa, &_prev_winch());
+  });
+#endif
+}
 
 // static void wait_for_write(int fd);
 
 // Write a buffer fully or not at all.
 // If false is returned, caller may check errno to see if it's EAGAIN
 // or a real error.
-bool write_harder(int fd, const char *buf, size_t len);
+inline bool write_harder(int fd, const char *buf, size_t len);
 
-// To more easily maintain the doubly-linked structure, loop to itself
-// rather than using NULL pointers.
 template <class Node>
-AtomicList<Node>::AtomicList()
-    : meta(static_cast<Node *>(&meta), static_cast<Node *>(&meta)) {}
+AtomicList<Node>::AtomicList() : meta(&meta), approx_tail(&meta), epoch(0) {
+  walkers[0].store(0);
+  walkers[1].store(0);
+}
 
 // Nothing to do - we didn't allocate any objects, merely borrow.
 template <class Node> AtomicList<Node>::~AtomicList() {
-  // TODO: We *really* shouldn't get here with a non-empty node set.
-  // Should we set all nodes to NULL to indicate they have?
-  // Otherwise we're stuck with dangling pointers in the edges ...
+  assert(this->empty() && "destroying a list which still has nodes");
+  // meta must not look attached to ~AtomicNode
+  meta.intrusive_link_next.store(0);
+}
+
+// Walk from `pred` to the last node, helping to take out nodes which are
+// being unlinked on the way. Starts over from the head whenever `pred`
+// turns out to be being unlinked itself.
+template <class Node>
+typename AtomicList<Node>::Link *AtomicList<Node>::_last(Link *pred) {
+  while (true) {
+    uintptr_t next = pred->intrusive_link_next.load(std::memory_order_acquire);
+    if (_marked(next)) {
+      pred = &meta;
+      continue;
+    }
+    Link *curr = _ptr(next);
+    if (curr == &meta)
+      return pred;
+    uintptr_t after = curr->intrusive_link_next.load(std::memory_order_acquire);
+    if (!_marked(after)) {
+      pred = curr;
+      continue;
+    }
+    // `curr` is being unlinked. Only succeeds if `pred` isn't, in which
+    // case `pred` is still reachable. Either way, retry from `pred`.
+    pred->intrusive_link_next.compare_exchange_strong(
+        next, after & ~uintptr_t(1), std::memory_order_acq_rel,
+        std::memory_order_acquire);
+  }
+}
+
+template <class Node> template <class F> void AtomicList<Node>::for_each(F f) {
+  WalkGuard guard(*this);
+  uintptr_t next = meta.intrusive_link_next.load(std::memory_order_acquire);
+  while (_ptr(next) != &meta) {
+    Link *curr = _ptr(next);
+    next = curr->intrusive_link_next.load(std::memory_order_acquire);
+    if (!_marked(next))
+      f(static_cast<Node *>(curr));
+  }
 }
 
 template <class Node> void AtomicList<Node>::append(Node *node) {
-  (void)node;
-#if 0
-  Node *singular = &meta;
-  // TODO when deletion is added, need to disable that
-  // for the duration of this function (using a spinlock).
-  // But, if the spinlock is currently held by the main thread,
-  // and we are a signal handler, we need to advance anyway.
-  // I think our spinlocks need to be recursive, which means tracking
-  // the thread ID.
-  //
-  // Actually, we might not need to disable it, just make sure it
-  // always points to a later node, perhaps? But what if there
-  // is no later node? Maybe use the list-itself-is-a-node trick?
-  assert (node->intrusive_link_next.load() == nullptr);
-  assert (node->intrusive_link_prev.load() == nullptr);
-  // Note that tail is a pointer to a (usually) NULL pointer.
-  std::atomic<Node *> *tail = this->approx_tail;
-  assert (tail != nullptr);
-  while (true)
-  {
-      // The tail may have moved, if someone else is also appending.
-      while (Node *tmp = tail->load())
-      {
-          tail = &tmp->intrusive_link_next;
-      }
-      // First argument is a reference, but we can't re-use
-      // the new value, because we want to advance.
-      Node *expected = nullptr;
-      if (tail->compare_exchange_weak(expected, node))
-      {
-          break;
-      }
+  Link *link = node;
+  assert(!link->is_attached() && "node is already in a list");
+  link->intrusive_link_next.store(_val(&meta), std::memory_order_relaxed);
+
+  WalkGuard guard(*this);
+  // The tail may have moved, if someone else is also appending, so start
+  // from a hint and walk forward. Since a node cannot be unlinked while we
+  // are walking (see `unlink`), the hint is always safe to dereference.
+  Link *tail = approx_tail.load();
+  while (true) {
+    tail = _last(tail);
+    uintptr_t expected = _val(&meta);
+    // fails if `tail` is no longer last, or is being unlinked
+    if (tail->intrusive_link_next.compare_exchange_weak(
+            expected, _val(link), std::memory_order_release,
+            std::memory_order_relaxed))
+      break;
   }
   // If we're wrong, nobody cares until the next append,
   // which will fix this anyway.
-  this->approx_tail = &node->intrusive_link_next;
-#endif
+  approx_tail.store(link);
+}
+
+template <class Node> void AtomicList<Node>::unlink(Node *node) {
+  Link *link = node;
+  assert(link->is_attached() && "node is not in a list");
+  {
+    WalkGuard guard(*this);
+    // Mark, so that nobody appends after us, and so that walks skip us.
+    uintptr_t next = link->intrusive_link_next.load();
+    while (!link->intrusive_link_next.compare_exchange_weak(
+        next, next | 1, std::memory_order_acq_rel))
+      ;
+    // Take out all marked nodes (which includes ours). Walks starting
+    // from now on cannot find us.
+    _last(&meta);
+    Link *expected = link;
+    approx_tail.compare_exchange_strong(expected, &meta);
+  }
+  // Wait for walks which may have started before the above, and may
+  // therefore still be looking at us.
+  _synchronise();
+  link->intrusive_link_next.store(0, std::memory_order_release);
+}
+
+// Waits for every walk in progress to finish, but not for those which
+// start meanwhile: they are counted under the other parity. Flipping
+// twice also catches a walk which read `epoch` just before a flip but
+// registered just after it (at most one such walk per thread).
+template <class Node> void AtomicList<Node>::_synchronise() {
+  std::lock_guard<std::mutex> lock(grace_lock);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (int flip = 0; flip < 2; ++flip) {
+    unsigned old = epoch.fetch_add(1);
+    while (walkers[old & 1].load() != 0)
+      std::this_thread::yield();
+  }
 }
 
 }  // tqdm
@@ -1,28 +1,380 @@
 #include "stdafx.h"
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
 #include "tqdm/tqdm.h"
 #include "tqdm/utils.h"
 
-int cat(FILE *in, FILE *out) {
-  char buffer[4096];
-  while (size_t bytes_read = fread(buffer, 1, sizeof(buffer), in)) {
-    char *buf_p = buffer;
-    size_t bytes_remaining = bytes_read;
-    while (bytes_remaining) {
-      size_t bytes_written = fwrite(buf_p, 1, bytes_remaining, out);
-      bytes_remaining -= bytes_written;
-      buf_p += bytes_written;
-      if (ferror(out)) {
-        perror("fwrite");
-        return 1;
+/**
+Usage: tqdm [--bytes | --delim=CHR] [--desc=DESC] [--total=N]
+            [--mininterval=SECONDS] < in > out
+       tqdm monitor [--dir=DIR] [--interval=SECONDS] [--once]
+       tqdm aggregate --socket=PATH [--desc=DESC] [--total=N]
+                      [--mininterval=SECONDS]
+
+Copies stdin to stdout, showing on stderr how many lines (or other
+`--delim`-separated items, as in the Python CLI) went past.
+`--bytes` counts bytes instead, which lets us skip copying through
+userspace where the kernel allows it:
+- file -> file: copy_file_range
+- pipe -> anything, anything -> pipe: splice
+- file -> anything: sendfile
+and otherwise uses read/write with a large page-aligned buffer.
+
+`monitor` draws, on stdout, the bars which running processes export to
+shared memory (`SinkOptions::Records::shm`, default DIR /dev/shm), until
+interrupted; `--once` draws a single frame.
+
+`aggregate` draws one bar (rate, ETA) for the increments which any number
+of processes send to PATH with tqdm::AggregateClient, until `--total` is
+reached or it is interrupted.
+*/
+
+// bytes per syscall, and the pipe size we ask for
+static const size_t CHUNK = 1 << 20;
+
+enum class Copy { done, unsupported, failed };
+
+static void wait_for_io(int in, int out) {
+  struct pollfd pfd[2];
+  pfd[0].fd = in;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = out;
+  pfd[1].events = POLLOUT;
+  (void)::poll(pfd, 2, -1);
+}
+
+/**
+Repeats `move(in, out, CHUNK)` (a splice-like call returning bytes moved)
+until EOF. Reports `unsupported` if the very first call is rejected by the
+kernel for these fds, so that the caller can try something else.
+*/
+template <class F>
+static Copy pump(int in, int out, tqdm::ConcurrentTqdm &bar, F move) {
+  bool first = true;
+  for (;;) {
+    ssize_t res = move(in, out, CHUNK);
+    if (res > 0) {
+      bar.update(size_t(res));
+      first = false;
+    } else if (res == 0) {
+      return Copy::done;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN) {
+      wait_for_io(in, out);
+    } else if (first && (errno == EINVAL || errno == ENOSYS ||
+                         errno == EXDEV || errno == ESPIPE ||
+                         errno == EOPNOTSUPP || errno == EBADF)) {
+      return Copy::unsupported;
+    } else {
+      return Copy::failed;
+    }
+  }
+}
+
+// `delim` < 0 counts bytes
+static Copy copy_buffered(int in, int out, tqdm::ConcurrentTqdm &bar,
+                          int delim) {
+  void *mem = nullptr;
+  if (posix_memalign(&mem, 4096, CHUNK))
+    return Copy::failed;
+  std::unique_ptr<char, decltype(&free)> buf((char *)mem, &free);
+  for (;;) {
+    ssize_t res = ::read(in, buf.get(), CHUNK);
+    if (res == 0)
+      return Copy::done;
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN) {
+        wait_for_io(in, -1);
+        continue;
       }
+      return Copy::failed;
     }
+    while (!tqdm::write_harder(out, buf.get(), size_t(res))) {
+      if (errno != EAGAIN)
+        return Copy::failed;
+      wait_for_io(-1, out);
+    }
+    bar.update(delim < 0 ? size_t(res)
+                         : tqdm::count_byte(buf.get(), size_t(res),
+                                            char(delim)));
+  }
+}
+
+static Copy copy_zero(int in, int out, tqdm::ConcurrentTqdm &bar) {
+  Copy res = Copy::unsupported;
+#ifdef __linux__
+  struct stat si, so;
+  if (fstat(in, &si) || fstat(out, &so))
+    return Copy::failed;
+  bool in_file = S_ISREG(si.st_mode) || S_ISBLK(si.st_mode);
+
+#ifdef SYS_copy_file_range
+  // procfs & co. claim size 0 and copy nothing
+  if (S_ISREG(si.st_mode) && si.st_size > 0 && S_ISREG(so.st_mode) &&
+      !(fcntl(out, F_GETFL) & O_APPEND))
+    res = pump(in, out, bar, [](int i, int o, size_t len) {
+      return (ssize_t)syscall(SYS_copy_file_range, i, nullptr, o, nullptr,
+                              len, 0u);
+    });
+#endif
+
+  if (res == Copy::unsupported &&
+      (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))) {
+    // bigger pipes mean fewer round trips; failure is harmless
+    if (S_ISFIFO(si.st_mode))
+      (void)fcntl(in, F_SETPIPE_SZ, int(CHUNK));
+    if (S_ISFIFO(so.st_mode))
+      (void)fcntl(out, F_SETPIPE_SZ, int(CHUNK));
+    res = pump(in, out, bar, [](int i, int o, size_t len) {
+      return splice(i, nullptr, o, nullptr, len,
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+    });
   }
-  if (ferror(in)) {
-    perror("fread");
+
+  if (res == Copy::unsupported && in_file)
+    res = pump(in, out, bar, [](int i, int o, size_t len) {
+      return sendfile(o, i, nullptr, len);
+    });
+#else
+  (void)in;
+  (void)out;
+  (void)bar;
+#endif
+  return res;
+}
+
+// `delim` < 0 counts bytes
+int cat(int in, int out, tqdm::ConcurrentTqdm &bar, int delim = -1) {
+  // counting delimiters needs to see the data
+  Copy res = delim < 0 ? copy_zero(in, out, bar) : Copy::unsupported;
+  if (res == Copy::unsupported)
+    res = copy_buffered(in, out, bar, delim);
+  if (res == Copy::failed) {
+    perror("tqdm");
     return 1;
   }
   return 0;
 }
 
-int main() { return cat(stdin, stdout); }
+static int usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [--bytes | --delim=CHR] [--desc=DESC]"
+          " [--total=N] [--mininterval=SECONDS] < in > out\n"
+          "       %s monitor [--dir=DIR] [--interval=SECONDS] [--once]\n"
+          "       %s aggregate --socket=PATH [--desc=DESC] [--total=N]"
+          " [--mininterval=SECONDS]\n",
+          argv0, argv0, argv0);
+  return 1;
+}
+
+// a line of text set by `monitor`
+class TextLine : public tqdm::AbstractLine {
+  std::string text;
+
+public:
+  void set(const std::string &s) {
+    if (s != text) {
+      text = s;
+      this->mark_dirty();
+    }
+  }
+  size_t format(char *buf, size_t len) override {
+    size_t n = text.size() < len ? text.size() : len;
+    memcpy(buf, text.data(), n);
+    return n;
+  }
+  void write(int fd) override {
+    if (tqdm::write_harder(fd, text.data(), text.size()))
+      this->not_dirty();
+  }
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+// one line per slot of every live export in `dir`, by file name
+static std::vector<std::string> poll_exports(const char *dir) {
+  std::vector<std::string> files, lines;
+  if (DIR *d = opendir(dir)) {
+    while (struct dirent *e = readdir(d))
+      if (!strncmp(e->d_name, "tqdm.", 5))
+        files.push_back(std::string(dir) + "/" + e->d_name);
+    closedir(d);
+  }
+  std::sort(files.begin(), files.end());
+  for (const std::string &file : files) {
+    tqdm::ShmView view(file.c_str());
+    if (!view.ok() || (kill(pid_t(view.pid()), 0) && errno == ESRCH))
+      continue;  // not ours, or left behind by a crash
+    for (size_t i = 0; i < view.slots(); ++i) {
+      tqdm::ShmSnapshot snap;
+      if (!view.snapshot(i, snap))
+        continue;
+      tqdm::Params p;
+      p.desc = std::to_string(view.pid());
+      if (snap.desc[0])
+        p.desc = p.desc + " " + snap.desc;
+      p.total = snap.total;
+      char buf[256];
+      size_t len = tqdm::MeterFormat(p).format(
+          buf, sizeof(buf), snap.n, float(snap.elapsed),
+          float(snap.ema_rate > 0 ? snap.ema_rate : snap.rate));
+      lines.push_back(std::string(buf, len));
+    }
+  }
+  return lines;
+}
+
+static int monitor(int argc, char **argv) {
+  const char *dir = "/dev/shm";
+  float interval = 0.1f;
+  bool once = false;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "--dir=", 6))
+      dir = arg + 6;
+    else if (!strncmp(arg, "--interval=", 11))
+      interval = strtof(arg + 11, nullptr);
+    else if (!strcmp(arg, "--once"))
+      once = true;
+    else
+      return usage("tqdm");
+  }
+  signal(SIGINT, [](int) { interrupted = 1; });
+  signal(SIGTERM, [](int) { interrupted = 1; });
+
+  tqdm::Sink sink(tqdm::SinkOptions(STDOUT_FILENO));
+  std::vector<std::unique_ptr<TextLine>> shown;
+  do {
+    std::vector<std::string> lines = poll_exports(dir);
+    while (shown.size() > lines.size()) {
+      sink.remove_line(shown.back().get());
+      shown.pop_back();
+    }
+    while (shown.size() < lines.size()) {
+      shown.emplace_back(new TextLine);
+      sink.add_line(shown.back().get());
+    }
+    for (size_t i = 0; i < lines.size(); ++i)
+      shown[i]->set(lines[i]);
+    sink.render();
+    if (!once)
+      std::this_thread::sleep_for(std::chrono::duration<float>(interval));
+  } while (!once && !interrupted);
+  // leave the last frame on screen
+  for (std::unique_ptr<TextLine> &line : shown)
+    sink.remove_line(line.get(), true);
+  return 0;
+}
+
+// "\n", "\0", "\t", "\\" or a single plain character, else -1
+static int parse_delim(const char *s) {
+  if (s[0] == '\\' && s[1] && !s[2]) {
+    switch (s[1]) {
+    case 'n':
+      return '\n';
+    case 'r':
+      return '\r';
+    case 't':
+      return '\t';
+    case '0':
+      return '\0';
+    case '\\':
+      return '\\';
+    default:
+      return -1;
+    }
+  }
+  return s[0] && !s[1] ? (unsigned char)s[0] : -1;
+}
+
+static int aggregate(int argc, char **argv) {
+  tqdm::Params p;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "--socket=", 9))
+      path = arg + 9;
+    else if (!strncmp(arg, "--desc=", 7))
+      p.desc = arg + 7;
+    else if (!strncmp(arg, "--total=", 8))
+      p.total = strtoull(arg + 8, nullptr, 10);
+    else if (!strncmp(arg, "--mininterval=", 14))
+      p.mininterval = strtof(arg + 14, nullptr);
+    else
+      return usage("tqdm");
+  }
+  if (!path)
+    return usage("tqdm");
+  tqdm::AggregateServer server(path);
+  if (!server.ok()) {
+    perror(path);
+    return 1;
+  }
+  signal(SIGINT, [](int) { interrupted = 1; });
+  signal(SIGTERM, [](int) { interrupted = 1; });
+  tqdm::ConcurrentTqdm bar(p);
+  while (!interrupted && bar.count() < p.total)
+    bar.update(server.receive(std::chrono::milliseconds(100)));
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "monitor"))
+    return monitor(argc - 1, argv + 1);
+  if (argc > 1 && !strcmp(argv[1], "aggregate"))
+    return aggregate(argc - 1, argv + 1);
+  tqdm::Params p;
+  int delim = '\n';
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "--desc=", 7))
+      p.desc = arg + 7;
+    else if (!strncmp(arg, "--total=", 8))
+      p.total = strtoull(arg + 8, nullptr, 10);
+    else if (!strncmp(arg, "--mininterval=", 14))
+      p.mininterval = strtof(arg + 14, nullptr);
+    else if (!strcmp(arg, "--bytes"))
+      delim = -1;
+    else if (!strncmp(arg, "--delim=", 8) &&
+             (delim = parse_delim(arg + 8)) >= 0)
+      ;
+    else
+      return usage(argv[0]);
+  }
+
+  if (delim < 0) {
+    p.unit = "B";
+    p.unit_scale = true;
+    p.unit_divisor = 1024;
+    struct stat si;
+    if (p.total == size_t(-1) && !fstat(STDIN_FILENO, &si) &&
+        S_ISREG(si.st_mode)) {
+      off_t pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+      if (pos >= 0 && si.st_size > pos)
+        p.total = size_t(si.st_size - pos);
+    }
+  }
+
+  // a slow terminal must not hold up the copy
+  tqdm::standard_sink().set_nonblocking(true);
+  int res;
+  {
+    tqdm::ConcurrentTqdm bar(p);
+    res = cat(STDIN_FILENO, STDOUT_FILENO, bar, delim);
+  }
+  return res;
+}
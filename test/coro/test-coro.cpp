@@ -0,0 +1,114 @@
+#include "../../src/stdafx.h"
+#include <coroutine>
+#include <cstdlib>  // abort
+#include <fcntl.h>  // open
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "tqdm/coro.h"
+
+// Like assert(), but also checked in Release (NDEBUG) builds.
+#define CHECK(cond)                                                          \
+  ((cond) ? (void)0                                                          \
+          : (fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,         \
+                     __LINE__, #cond),                                       \
+             abort()))
+
+static_assert(TQDM_COROUTINES, "built with -std=c++20");
+
+static tqdm::generator<int> count_to(int n) {
+  for (int i = 1; i <= n; ++i)
+    co_yield i;
+}
+
+static tqdm::generator<const std::string &> words_then_throw() {
+  std::string w = "a";
+  co_yield w;
+  co_yield std::string("bb");
+  throw std::runtime_error("read error");
+}
+
+// Completes at once, with a value or by throwing.
+struct Ready {
+  bool fail;
+  bool await_ready() const noexcept { return true; }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  int await_resume() const {
+    if (fail)
+      throw std::runtime_error("failed");
+    return 1;
+  }
+};
+
+// Eager, fire-and-forget.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { abort(); }
+  };
+};
+
+static Task await_both(tqdm::ConcurrentTqdm &bar, int &got, bool &threw) {
+  got = co_await tqdm::counted(bar, Ready{false});
+  try {
+    got += co_await tqdm::counted(bar, Ready{true});
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+}
+
+int main() {
+  int devnull = open("/dev/null", O_WRONLY);
+  tqdm::SinkOptions opts(devnull);
+  tqdm::Sink sink(opts);
+  tqdm::Params p;
+
+  printf("co_tqdm counts what a generator yields\n");
+  {
+    auto bar = tqdm::co_tqdm(count_to(5), p, sink);
+    int sum = 0;
+    for (int x : bar)
+      sum += x;
+    CHECK(sum == 15);
+    CHECK(bar.count() == 5);
+
+    std::vector<int> v(7, 1);
+    auto lv = tqdm::co_tqdm(v, p, sink);  // held by reference
+    for (int &x : lv)
+      x = 2;
+    CHECK(lv.count() == 7 && v[6] == 2);
+  }
+
+  printf("generator exceptions propagate from operator++\n");
+  {
+    auto bar = tqdm::co_tqdm(words_then_throw(), p, sink);
+    std::string seen;
+    bool threw = false;
+    try {
+      for (const std::string &w : bar)
+        seen += w;
+    } catch (const std::runtime_error &e) {
+      threw = std::string(e.what()) == "read error";
+    }
+    CHECK(threw);
+    CHECK(seen == "abb");
+    CHECK(bar.count() == 2);  // both words were done with
+  }
+
+  printf("counted counts completions, including those which throw\n");
+  {
+    tqdm::ConcurrentTqdm bar(p, sink);
+    int got = 0;
+    bool threw = false;
+    await_both(bar, got, threw);
+    CHECK(got == 1);
+    CHECK(threw);
+    CHECK(bar.count() == 2);
+  }
+
+  close(devnull);
+  return 0;
+}
@@ -1,8 +1,67 @@
 #include "../src/stdafx.h"
+#include <algorithm>
+#include <atomic>
 #include <cstring>  //memcpy
+#include <csignal>  // raise
+#include <cstdlib>  // abort
+#include <fcntl.h>  // open
+#include <forward_list>
+#include <future>
+#include <iterator>
+#include <list>
+#include <sstream>
+#include <string>
+#include <sys/ioctl.h>  // TIOCSWINSZ
+#include <thread>
+#include <unistd.h>  // pipe
 #include <vector>
+#include "tqdm/mmap.h"
+#include "tqdm/parallel.h"
+#include "tqdm/stream.h"
 #include "tqdm/tqdm.h"
 
+// Like assert(), but also checked in Release (NDEBUG) builds.
+#define CHECK(cond)                                                          \
+  ((cond) ? (void)0                                                          \
+          : (fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,         \
+                     __LINE__, #cond),                                       \
+             abort()))
+
+// The rows of a terminal after it was sent what `f` holds: text, \r, \n
+// and CSI [n] A/C/K, which is all Sinks write.
+static std::vector<std::string> screen(FILE *f) {
+  char buf[4096];
+  fflush(f);
+  fseek(f, 0, SEEK_SET);
+  size_t len = fread(buf, 1, sizeof(buf), f), row = 0, col = 0;
+  std::vector<std::string> rows(1);
+  for (size_t i = 0; i < len; ++i) {
+    if (buf[i] == '\r') {
+      col = 0;
+    } else if (buf[i] == '\n') {
+      if (++row == rows.size())
+        rows.emplace_back();
+    } else if (buf[i] == '\x1b') {
+      size_t arg = 0;
+      for (i += 2; i < len && isdigit((unsigned char)buf[i]); ++i)
+        arg = arg * 10 + size_t(buf[i] - '0');
+      if (buf[i] == 'A')
+        row -= std::min(row, arg ? arg : 1);
+      else if (buf[i] == 'C')
+        col += arg ? arg : 1;
+      else if (buf[i] == 'K' && col < rows[row].size())
+        rows[row].resize(col);
+    } else {
+      if (col >= rows[row].size())
+        rows[row].resize(col + 1, ' ');
+      rows[row][col++] = buf[i];
+    }
+  }
+  while (rows.size() > 1 && rows.back().empty())
+    rows.pop_back();
+  return rows;
+}
+
 int main() {
   static const size_t N = 1 << 13;
 
@@ -21,6 +80,12 @@ int main() {
   for (auto i = tqdm::tqdm(b.begin(), N); i; ++i)
     ;
 
+  printf("iterator, total, fixed miniters\n");
+  tqdm::Params p;
+  p.miniters = 1000;
+  for (auto i = tqdm::tqdm(b.begin(), N, p); i; ++i)
+    ;
+
   printf("container, post-increment\n");
   for (auto i = tqdm::tqdm(b); i; i++)
     ;
@@ -56,5 +121,876 @@ int main() {
     printf("%.5f ", i);
   printf("\n");
 
+  printf("random access and chunks\n");
+  {
+    tqdm::Params p;
+    p.f = tmpfile();
+    {
+      auto it = tqdm::tqdm(b, p);
+      static_assert(
+          std::is_same<std::iterator_traits<decltype(it)>::iterator_category,
+                       std::random_access_iterator_tag>::value,
+          "category of std::vector<int>::iterator");
+      it += 100;
+      CHECK(*it == 100 && it[5] == 105 && it.remaining() == N - 100);
+      it -= 10;
+      --it;
+      CHECK(*it == 89 && (it + 11) - it == 11 && it < it + 1);
+      auto found = std::lower_bound(it, it + 1000, 500);
+      CHECK(*found == 500);
+
+      size_t blocks = 0, items = 0;
+      long long sum = 0;
+      for (auto block : tqdm::tqdm(b, p).chunks(1000)) {
+        ++blocks;
+        items += block.size();
+        for (int x : block)
+          sum += x;
+      }
+      CHECK(blocks == (N + 999) / 1000 && items == N);
+      CHECK(sum == (long long)N * (N - 1) / 2);
+    }
+    fclose(p.f);
+
+    auto r = tqdm::range(0, 10, 3);
+    CHECK(r.remaining() == 4 && r[3] == 9);
+    size_t count = 0;
+    for (int i : r)
+      count += i >= 0;
+    CHECK(count == 4);
+  }
+
+  printf("disabled at runtime: no output\n");
+  {
+    tqdm::Params p;
+    p.disable = true;
+    p.f = tmpfile();
+    for (float &i : tqdm::tqdm(foo, p))
+      i = 0;
+    auto it = tqdm::tqdm(foo.begin(), foo.size(), p);
+    while (it)
+      ++it;
+    CHECK(ftell(p.f) == 0);
+    fclose(p.f);
+  }
+
+  printf("input iterators and lists: no total, or an estimate\n");
+  {
+    // what a bar's row last showed, as a terminal would have drawn it
+    auto last_frame = [](FILE *f) {
+      char buf[4096];
+      fseek(f, 0, SEEK_SET);
+      size_t len = fread(buf, 1, sizeof(buf), f), col = 0;
+      std::string row;
+      for (size_t i = 0; i < len; ++i) {
+        if (buf[i] == '\r') {
+          col = 0;
+        } else if (buf[i] == '\x1b') {  // CSI [n] C/K/A
+          size_t arg = 0;
+          for (i += 2; i < len && isdigit((unsigned char)buf[i]); ++i)
+            arg = arg * 10 + size_t(buf[i] - '0');
+          if (buf[i] == 'C')
+            col += arg;
+          else if (buf[i] == 'K' && col < row.size())
+            row.resize(col);
+        } else if (buf[i] != '\n') {
+          if (col >= row.size())
+            row.resize(col + 1, ' ');
+          row[col++] = buf[i];
+        }
+      }
+      return row;
+    };
+    tqdm::Params p;
+    p.f = tmpfile();
+    p.miniters = 1;
+    std::istringstream words("a b c d e f g");
+    size_t k = 0;
+    typedef std::istream_iterator<std::string> WordIt;
+    for (const std::string &w : tqdm::tqdm(WordIt(words), WordIt(), p))
+      k += w.size();
+    CHECK(k == 7);
+    // count and rate only, up to the last word
+    CHECK(last_frame(p.f).compare(0, 5, "7it [") == 0);
+    p.miniters = unsigned(-1);
+    fclose(p.f);
+
+    p.f = tmpfile();
+    p.total = 4;  // too low: grows to 8
+    std::forward_list<int> fl(6, 1);
+    k = 0;
+    for (int x : tqdm::tqdm(fl, p))
+      k += size_t(x);
+    CHECK(k == 6);
+    CHECK(last_frame(p.f).find(" 6/8 ") != std::string::npos);
+    fclose(p.f);
+
+    p.f = tmpfile();
+    p.total = size_t(-1);
+    std::list<int> l(5, 1);  // knows its size
+    for (int x : tqdm::tqdm(l, p))
+      k += size_t(x);
+    CHECK(last_frame(p.f).find("100%") != std::string::npos);
+    fclose(p.f);
+  }
+
+  printf("disabled at compile time: raw iterators\n");
+  {
+    auto it = tqdm::tqdm<float *, tqdm::NoTqdm<float *>>(foo.data(),
+                                                          foo.size());
+    float *raw = it.begin();
+    CHECK(raw == foo.data() && it.end() == foo.data() + foo.size());
+    size_t k = 0;
+    for (; it != it.end(); ++it)
+      ++k;
+    CHECK(k == foo.size() && !it);
+  }
+
+  printf("clock policies\n");
+  {
+    tqdm::Params p;
+    p.f = tmpfile();
+    {
+      typedef std::vector<float>::iterator VecIt;
+      size_t k = 0;
+      for (float x : tqdm::Tqdm<VecIt, tqdm::CoarseClock>(foo, p))
+        k += x == x;
+      for (float x : tqdm::Tqdm<VecIt, tqdm::TscClock>(foo, p))
+        k += x == x;
+      CHECK(k == 2 * foo.size());
+    }
+    fclose(p.f);
+    tqdm::TscClock::time_point t0 = tqdm::TscClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        tqdm::TscClock::now() - t0);
+    CHECK(ms.count() >= 19 && ms.count() < 1000);
+  }
+
+  printf("streambuf counts bytes a buffer at a time\n");
+  {
+    std::string text;
+    for (int i = 0; i < 100000; ++i)
+      text += std::to_string(i) + "\n";
+    std::stringbuf src(text);
+    tqdm::Params p;
+    p.f = tmpfile();
+    size_t lines = 0;
+    {
+      tqdm::istream in(&src, p);
+      for (std::string line; std::getline(in, line);)
+        lines += line == std::to_string(lines);
+      CHECK(in.count() == text.size());
+    }
+    CHECK(lines == 100000);
+    char last[256];
+    long len = ftell(p.f);
+    fseek(p.f, len > 200 ? len - 200 : 0, SEEK_SET);
+    last[fread(last, 1, sizeof(last) - 1, p.f)] = '\0';
+    CHECK(strstr(last, "100%"));  // total from the size, in bytes
+
+    std::stringbuf dst;
+    {
+      tqdm::streambuf sb(&dst, p);
+      std::ostream out(&sb);
+      out << "abc";
+      out.write(text.data(), std::streamsize(text.size()));
+      out.flush();
+      CHECK(sb.count() == text.size() + 3);
+    }
+    CHECK(dst.str() == "abc" + text);
+
+    // counts the reads from the wrapped buffer
+    struct Reads : std::stringbuf {
+      size_t calls;
+      explicit Reads(const std::string &s) : std::stringbuf(s), calls(0) {}
+      std::streamsize xsgetn(char *s, std::streamsize n) override {
+        ++calls;
+        return std::stringbuf::xsgetn(s, n);
+      }
+    } reads(text);
+    {
+      tqdm::istream in(&reads, p);
+      std::streamoff pos = 0;
+      bool at = true;
+      for (std::string line; std::getline(in, line);) {
+        pos += std::streamoff(line.size() + 1);
+        at &= in.tellg() == std::streampos(pos);
+      }
+      CHECK(at && pos == std::streamoff(text.size()));
+      CHECK(in.count() == text.size());
+    }
+    CHECK(reads.calls <= text.size() / (1 << 16) + 2);  // a buffer each
+    fclose(p.f);
+  }
+
+  printf("mapped_file iterates over records, advising as it goes\n");
+  {
+    char path[] = "/tmp/tqdm-test-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    std::vector<uint32_t> recs(1 << 18);
+    for (size_t i = 0; i < recs.size(); ++i)
+      recs[i] = uint32_t(i * 7);
+    CHECK(write(fd, recs.data(), recs.size() * 4) ==
+          ssize_t(recs.size() * 4));
+    close(fd);
+    tqdm::Params p;
+    p.f = tmpfile();
+    {
+      tqdm::mapped_file<uint32_t> file(path, p, 1 << 16);
+      CHECK(file.size() == recs.size());
+      size_t i = 0, ok = 0;
+      for (const uint32_t &r : file)
+        ok += r == recs[i++];
+      CHECK(i == recs.size() && ok == i);
+    }
+    fclose(p.f);
+    unlink(path);
+    bool threw = false;
+    try {
+      tqdm::mapped_file<uint32_t> missing(path);
+    } catch (std::system_error &e) {
+      threw = e.code().value() == ENOENT;
+    }
+    CHECK(threw);
+  }
+
+  printf("AtomicList append/unlink/for_each from several threads\n");
+  {
+    tqdm::AtomicList<tqdm::AbstractLine> lines;
+    tqdm::StaticTextLine first("first"), last("last");
+    lines.append(&first);
+    std::atomic<bool> stop(false);
+    std::thread walker([&] {
+      while (!stop.load())
+        lines.for_each([](tqdm::AbstractLine *line) {
+          CHECK(line->is_attached());
+          char c;
+          line->format(&c, 1);
+        });
+    });
+    std::vector<std::thread> churn;
+    for (int t = 0; t < 4; ++t)
+      churn.emplace_back([&] {
+        for (int i = 0; i < 10000; ++i) {
+          tqdm::StaticTextLine line("churn");
+          lines.append(&line);
+          lines.unlink(&line);
+        }
+      });
+    for (std::thread &t : churn)
+      t.join();
+    stop.store(true);
+    walker.join();
+    lines.append(&last);
+    std::string seen;
+    lines.for_each([&](tqdm::AbstractLine *line) {
+      char buf[8];
+      seen.append(buf, line->format(buf, sizeof(buf)));
+    });
+    CHECK(seen == "firstlast");
+    lines.unlink(&first);
+    lines.unlink(&last);
+    CHECK(lines.empty());
+  }
+
+  printf("AtomicList unlink while walks never stop\n");
+  {
+    // Walks overlap (each yields halfway), so that at no point is nobody
+    // walking: unlink must only wait for the walks which could see its node.
+    tqdm::AtomicList<tqdm::AbstractLine> lines;
+    tqdm::StaticTextLine a("a"), b("b");
+    lines.append(&a);
+    lines.append(&b);
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> walks(0);
+    std::vector<std::thread> walkers;
+    for (int t = 0; t < 3; ++t)
+      walkers.emplace_back([&] {
+        while (!stop.load()) {
+          lines.for_each([](tqdm::AbstractLine *line) {
+            CHECK(line->is_attached());
+            std::this_thread::yield();
+          });
+          walks.fetch_add(1);
+        }
+      });
+    while (walks.load() < 100)
+      std::this_thread::yield();
+    for (int i = 0; i < 1000; ++i) {
+      tqdm::StaticTextLine line("churn");
+      lines.append(&line);
+      lines.unlink(&line);
+    }
+    stop.store(true);
+    for (std::thread &t : walkers)
+      t.join();
+    lines.unlink(&a);
+    lines.unlink(&b);
+    CHECK(lines.empty());
+  }
+
+  printf("Sink renders dirty lines in a single write\n");
+  {
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    tqdm::SinkOptions opts(fds[1]);
+    tqdm::Sink sink(opts);
+    tqdm::CounterLine a("a", 10), b("b");
+    sink.add_line(&a);
+    sink.add_line(&b);
+    a.update(3);
+    CHECK(sink.render());
+    CHECK(!sink.render());  // nothing dirty
+    b.update();
+    CHECK(sink.render());  // only redraws b, and only what changed
+    char buf[256];
+    ssize_t len = read(fds[0], buf, sizeof(buf));
+    CHECK(std::string(buf, size_t(len)) ==
+          "\ra: 3/10\x1b[K\n\rb: 0\x1b[K\r\x1b[1A"
+          "\n\rb: 1\r\x1b[1A");
+    sink.remove_line(&a);
+    sink.remove_line(&b);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("append_line_diff writes only the spans which changed\n");
+  {
+    auto diff = [](const char *prev, const char *next) {
+      std::vector<char> out;
+      bool changed = tqdm::append_line_diff(out, prev, strlen(prev), next,
+                                            strlen(next));
+      CHECK(changed == !out.empty());
+      return std::string(out.begin(), out.end());
+    };
+    CHECK(diff("d:  50%|#####     | 50/100", "d:  50%|#####     | 50/100")
+              .empty());
+    // far apart: moved to; close together: merged
+    CHECK(diff("d:  50%|#####     | 50/100", "d:  51%|#####     | 51/100") ==
+          "\r\x1b[5C1\x1b[15C1");
+    CHECK(diff("12345678", "1x3x5678") == "\r1x3x");
+    CHECK(diff("abcdef", "abc") == "\rabc\x1b[K");
+    CHECK(diff("abc", "abcdef") == "\rabcdef");
+
+    // through a Sink: unchanged frames are skipped, and anything but
+    // printable ASCII is redrawn whole
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    tqdm::SinkOptions opts(fds[1]);
+    tqdm::Sink sink(opts);
+    tqdm::CounterLine a("ab"), u("\xc3\xa9");
+    sink.add_line(&a);
+    CHECK(sink.render());
+    a.mark_dirty();
+    CHECK(!sink.render());  // dirty, but drawn as it is already
+    a.update(12);
+    CHECK(sink.render());
+    sink.add_line(&u);
+    CHECK(sink.render());
+    u.update();
+    CHECK(sink.render());
+    char buf[256];
+    ssize_t len = read(fds[0], buf, sizeof(buf));
+    CHECK(std::string(buf, size_t(len)) ==
+          "\rab: 0\x1b[K\r"
+          "\rab: 12\r"
+          "\n\r\xc3\xa9: 0\x1b[K\r\x1b[1A"
+          "\n\r\xc3\xa9: 1\x1b[K\r\x1b[1A");
+    sink.remove_line(&a);
+    sink.remove_line(&u);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("Sink positions: lowest free row, explicit rows, moving up\n");
+  {
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    tqdm::SinkOptions opts(fds[1]);
+    tqdm::Sink sink(opts);
+    tqdm::CounterLine a("a"), b("b"), c("c");
+    sink.add_line(&a);
+    sink.add_line(&c, 3);
+    sink.add_line(&b);  // takes row 1, the lowest free one
+    CHECK(sink.render());
+    sink.remove_line(&a);  // b and c move up, and the rest is cleared
+    char buf[256];
+    ssize_t len = read(fds[0], buf, sizeof(buf));
+    CHECK(std::string(buf, size_t(len)) ==
+          "\ra: 0\x1b[K\n\rb: 0\x1b[K\n\n\rc: 0\x1b[K\r\x1b[3A"
+          "\rb: 0\x1b[K\n\r\x1b[K\n\rc: 0\x1b[K\n\r\x1b[K\r\x1b[3A");
+    sink.remove_line(&b, true);  // left on screen
+    sink.remove_line(&c);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("bars on the same stream share a Sink, whatever the stream\n");
+  {
+    tqdm::Params p;
+    p.f = tmpfile();
+    p.total = 10;
+    p.miniters = 1;
+    {
+      tqdm::Meter<> outer(p);
+      {
+        tqdm::Meter<> inner(p);  // the row below, not over `outer`
+        outer.update(3);
+        inner.update(5);
+        std::vector<std::string> rows = screen(p.f);
+        CHECK(rows.size() == 2);
+        CHECK(rows[0].find(" 3/10 ") != std::string::npos);
+        CHECK(rows[1].find(" 5/10 ") != std::string::npos);
+        CHECK(tqdm::shared_sink(fileno(p.f)).use_count() == 3);
+        inner.close(10);
+      }
+      outer.close(10);
+    }
+    std::vector<std::string> rows = screen(p.f);
+    CHECK(rows.size() == 1 && rows[0].find(" 10/10 ") != std::string::npos);
+    CHECK(tqdm::shared_sink(fileno(p.f)).use_count() == 1);  // a new one
+    fclose(p.f);
+  }
+
+  printf("terminal width, cached until resized\n");
+  {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0 && !grantpt(master) && !unlockpt(master));
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    CHECK(slave >= 0);
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = 60;
+    ws.ws_row = 20;
+    CHECK(!ioctl(slave, TIOCSWINSZ, &ws));
+    tqdm::Params p;
+    p.f = fdopen(slave, "w");
+    p.total = 100;
+    p.dynamic_ncols = true;
+    {
+      tqdm::Meter<> meter(p);
+      char buf[256];
+      CHECK(meter.format(buf, sizeof(buf)) == 60);
+      ws.ws_col = 80;
+      CHECK(!ioctl(slave, TIOCSWINSZ, &ws));
+      CHECK(meter.format(buf, sizeof(buf)) == 60);  // not asked again
+      tqdm::shared_sink(slave)->mark_resized();
+      CHECK(meter.format(buf, sizeof(buf)) == 80);
+      tqdm::watch_resize();
+      ws.ws_col = 100;
+      CHECK(!ioctl(slave, TIOCSWINSZ, &ws));
+      CHECK(meter.format(buf, sizeof(buf)) == 80);
+      raise(SIGWINCH);
+      CHECK(meter.format(buf, sizeof(buf)) == 100);
+      meter.close(100);
+    }
+    fclose(p.f);
+    close(master);
+  }
+
+  printf("Sink asks the terminal size once, not every frame\n");
+  {
+    FILE *f = tmpfile();
+    std::shared_ptr<tqdm::Sink> sink = tqdm::shared_sink(fileno(f));
+    tqdm::CounterLine a("a");
+    sink->add_line(&a);
+    for (int i = 0; i < 10; ++i) {
+      a.update();
+      CHECK(sink->render());
+    }
+    CHECK(sink->size_queries() == 0);  // no line fits the width
+    tqdm::Params p;
+    p.f = f;
+    p.total = 100;
+    {
+      tqdm::Meter<> meter(p);  // `ncols` unspecified: fits the width
+      for (int i = 0; i < 10; ++i) {
+        a.update();
+        CHECK(sink->render());
+      }
+      CHECK(sink->size_queries() == 1);
+      sink->mark_resized();
+      for (int i = 0; i < 10; ++i) {
+        a.update();
+        CHECK(sink->render());
+      }
+      CHECK(sink->size_queries() == 2);
+      meter.close(100);
+    }
+    sink->remove_line(&a);
+    fclose(f);
+  }
+
+  printf("non-blocking Sink drops frames a full pipe cannot take\n");
+  {
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    int flags = fcntl(fds[1], F_GETFL);
+    fcntl(fds[1], F_SETFL, flags | O_NONBLOCK);
+    char junk[4096] = {0};
+    while (write(fds[1], junk, sizeof(junk)) > 0)
+      ;
+    fcntl(fds[1], F_SETFL, flags);
+    tqdm::SinkOptions opts(fds[1]);
+    opts.nonblocking = true;
+    tqdm::Sink sink(opts);
+    tqdm::CounterLine a("a");
+    sink.add_line(&a);
+    a.update();
+    CHECK(!sink.render() && sink.dropped_frames() == 1);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    while (read(fds[0], junk, sizeof(junk)) > 0)
+      ;
+    CHECK(sink.render());  // redraws what the dropped frame had
+    ssize_t len = read(fds[0], junk, sizeof(junk));
+    CHECK(std::string(junk, size_t(len)) == "\ra: 1\x1b[K\r");
+    CHECK(fcntl(fds[1], F_GETFL) == flags);  // fd itself left alone
+    sink.remove_line(&a);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("non-blocking Sink queues a closing bar's frame, not waits\n");
+  {
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    int flags = fcntl(fds[1], F_GETFL);
+    fcntl(fds[1], F_SETFL, flags | O_NONBLOCK);
+    char junk[4096] = {0};
+    while (write(fds[1], junk, sizeof(junk)) > 0)
+      ;
+    fcntl(fds[1], F_SETFL, flags);
+    tqdm::SinkOptions opts(fds[1]);
+    opts.nonblocking = true;
+    tqdm::Sink sink(opts);
+    tqdm::Params p;
+    p.leave = false;
+    std::unique_ptr<tqdm::ConcurrentTqdm> bar(
+        new tqdm::ConcurrentTqdm(p, sink));
+    bar->update(5);
+    // as a worker thread would, while the pipe stays full
+    std::future<void> closed =
+        std::async(std::launch::async, [&] { bar.reset(); });
+    CHECK(closed.wait_for(std::chrono::seconds(5)) ==
+          std::future_status::ready);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    while (read(fds[0], junk, sizeof(junk)) > 0)
+      ;
+    CHECK(!sink.render());  // nothing to draw, but the queue is written
+    ssize_t len = read(fds[0], junk, sizeof(junk));
+    CHECK(len > 0 && std::string(junk, size_t(len)) == "\r\x1b[K\r");
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("Sink writes throttled JSON/binary records\n");
+  {
+    int fds[2];
+    if (pipe(fds))
+      return 1;
+    tqdm::SinkOptions opts(fds[1]);
+    opts.records = tqdm::SinkOptions::Records::json;
+    opts.record_interval = 3600;
+    tqdm::Sink sink(opts);
+    tqdm::CounterLine a("a \"q\"", 10);
+    sink.add_line(&a);
+    a.update(3);
+    CHECK(sink.render());
+    a.update();
+    CHECK(!sink.render());  // not due for another hour
+    sink.remove_line(&a);    // but the last one always is
+    char buf[512];
+    ssize_t len = read(fds[0], buf, sizeof(buf));
+    CHECK(std::string(buf, size_t(len)) ==
+          "{\"desc\":\"a \\\"q\\\"\",\"n\":3,\"total\":10,\"elapsed\":0.000,"
+          "\"rate\":0,\"ema_rate\":0}\n"
+          "{\"desc\":\"a \\\"q\\\"\",\"n\":4,\"total\":10,\"elapsed\":0.000,"
+          "\"rate\":0,\"ema_rate\":0}\n");
+
+    sink.set_records(tqdm::SinkOptions::Records::binary, 0);
+    tqdm::CounterLine b("bytes");
+    sink.add_line(&b);
+    b.update(42);
+    CHECK(sink.render());
+    tqdm::BinaryRecord rec;
+    CHECK(read(fds[0], &rec, sizeof(rec)) == sizeof(rec));
+    CHECK(!memcmp(rec.magic, "TQDM", 4) && rec.size == sizeof(rec));
+    CHECK(rec.n == 42 && rec.total == UINT64_MAX);
+    CHECK(std::string(rec.desc) == "bytes");
+    sink.remove_line(&b);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  printf("Sink publishes to shared memory, read back with a seqlock\n");
+  {
+    char dir[] = "/tmp/tqdm-test-XXXXXX";
+    if (!mkdtemp(dir))
+      return 1;
+    tqdm::SinkOptions opts(-1);
+    opts.records = tqdm::SinkOptions::Records::shm;
+    opts.record_interval = 0;
+    opts.shm_dir = dir;
+    std::string file;
+    {
+      tqdm::Sink sink(opts);
+      CHECK(sink.shm_file());
+      file = sink.shm_file();
+      tqdm::CounterLine a("a", 10), b("b");
+      sink.add_line(&a);
+      sink.add_line(&b);
+      a.update(7);
+      CHECK(sink.render());
+      sink.remove_line(&b);
+
+      tqdm::ShmView view(file.c_str());
+      CHECK(view.ok() && view.pid() == long(getpid()));
+      tqdm::ShmSnapshot snap;
+      CHECK(view.snapshot(0, snap) && !snap.done);
+      CHECK(snap.n == 7 && snap.total == 10 && !strcmp(snap.desc, "a"));
+      CHECK(view.snapshot(1, snap) && snap.done && snap.total == size_t(-1));
+      CHECK(!view.snapshot(2, snap));
+      sink.remove_line(&a);
+    }
+    CHECK(access(file.c_str(), F_OK) != 0);  // removed with the Sink
+    rmdir(dir);
+  }
+
+  printf("AggregateClient deltas reach an AggregateServer\n");
+  {
+    std::string path = "/tmp/tqdm-test-" + std::to_string(getpid());
+    tqdm::AggregateServer server(path.c_str());
+    CHECK(server.ok());
+    {
+      tqdm::AggregateClient client(path.c_str(), std::chrono::hours(1));
+      client.update(5);
+      CHECK(client.flush());
+      client.update(2);  // sent on destruction
+    }
+    size_t n = 0;
+    while (size_t k = server.receive(std::chrono::milliseconds(100)))
+      n += k;
+    CHECK(n == 7 && server.received() == 2);
+  }
+
+  printf("ConcurrentTqdm updated from several threads\n");
+  int devnull = open("/dev/null", O_WRONLY);
+  {
+    tqdm::SinkOptions opts(devnull);
+    tqdm::Sink sink(opts);
+    tqdm::Params p;
+    p.total = 4 * N;
+    p.desc = "concurrent";
+    {
+      tqdm::ConcurrentTqdm bar(p, sink);
+      std::vector<std::thread> workers;
+      for (int t = 0; t < 4; ++t)
+        workers.emplace_back([&] {
+          for (size_t i = 0; i < N; ++i)
+            bar.update();
+        });
+      for (std::thread &t : workers)
+        t.join();
+      CHECK(bar.count() == 4 * N);
+      char buf[64];
+      buf[bar.format(buf, sizeof(buf))] = '\0';
+      CHECK(std::string(buf).find(
+                "concurrent: 100%|##########| 32768/32768 [") == 0);
+
+      // the render thread ticks at the shortest `mininterval` of its lines
+      CHECK(sink.render_thread_interval() == std::chrono::milliseconds(100));
+      {
+        tqdm::Params q = p;
+        q.mininterval = 0.01f;
+        tqdm::ConcurrentTqdm fast(q, sink);
+        CHECK(sink.render_thread_interval() ==
+              std::chrono::milliseconds(10));
+      }
+      CHECK(sink.render_thread_interval() == std::chrono::milliseconds(100));
+      CHECK(sink.has_render_thread());
+    }
+    // and stops with the last of them
+    CHECK(!sink.has_render_thread());
+  }
+  close(devnull);
+
+  printf("parallel_for shows one bar, as the Tqdm passed says\n");
+  {
+    tqdm::ThreadPool pool(4);
+    tqdm::Params p;
+    p.f = tmpfile();
+    p.desc = "par";
+    std::vector<int> v(N, 1);
+    std::atomic<size_t> sum(0);
+    tqdm::parallel_for(tqdm::tqdm(v, p), [&](int x) { sum += size_t(x); },
+                       pool);
+    CHECK(sum == N);
+    std::vector<std::string> rows = screen(p.f);
+    CHECK(rows.size() == 1);
+    CHECK(rows[0].find("par: 100%|##########| 8192/8192 [") == 0);
+    fclose(p.f);
+
+    // or as the Params passed say, and the Tqdm's own bar is not shown
+    p.f = tmpfile();
+    tqdm::Params q = p;
+    q.f = tmpfile();
+    q.desc = "q";
+    CHECK(tqdm::parallel_reduce(tqdm::tqdm(v, p), size_t(0),
+                                [](size_t a, size_t b) { return a + b; },
+                                [](int x) { return size_t(x); }, q,
+                                pool) == N);
+    CHECK(screen(p.f) == std::vector<std::string>(1));
+    rows = screen(q.f);
+    CHECK(rows.size() == 1 && rows[0].find("q: 100%") == 0);
+    fclose(q.f);
+
+    // a disabled Tqdm: no bar at all; containers work too
+    p.disable = true;
+    tqdm::parallel_for(tqdm::tqdm(v, p), [](int &x) { x = 2; }, pool);
+    CHECK(screen(p.f) == std::vector<std::string>(1));
+    tqdm::parallel_for(v, [](int &x) { ++x; }, p, pool);
+    CHECK(std::count(v.begin(), v.end(), 3) == std::ptrdiff_t(N));
+    fclose(p.f);
+  }
+
+  printf("parallel_for/parallel_reduce on a small pool\n");
+  {
+    tqdm::ThreadPool pool(4);
+    tqdm::Params p;
+    p.disable = true;
+    std::vector<std::atomic<int>> hits(N);
+    tqdm::parallel_for(tqdm::range(N),
+                       [&](size_t i) { hits[i].fetch_add(1); }, p, pool);
+    for (auto &h : hits)
+      CHECK(h.load() == 1);
+
+    long long sum = tqdm::parallel_reduce(
+        tqdm::range(0LL, 3LL * (long long)N, 3LL), 7LL,
+        [](long long a, long long b) { return a + b; },
+        [](long long i) { return i; }, p, pool);
+    CHECK(sum == 7 + 3LL * N * (N - 1) / 2);
+    CHECK(tqdm::parallel_reduce(tqdm::tqdm(b, p), 0LL,
+                                [](long long a, long long b) {
+                                  return a + b;
+                                 },
+                                 [](int x) { return (long long)x; }, p,
+                                 pool) == (long long)N * (N - 1) / 2);
+
+    bool threw = false;
+    try {
+      tqdm::parallel_for(tqdm::range(N),
+                         [](size_t i) {
+                           if (i == N / 2)
+                             throw std::runtime_error("boom");
+                         },
+                         p, pool);
+    } catch (std::runtime_error &) {
+      threw = true;
+    }
+    CHECK(threw);
+
+    // nested loops run the inner one on the calling worker
+    std::atomic<size_t> inner(0);
+    tqdm::parallel_for(tqdm::range(8),
+                       [&](int) {
+                         tqdm::parallel_for(
+                             tqdm::range(100), [&](int) { ++inner; }, p,
+                             pool);
+                       },
+                       p, pool);
+    CHECK(inner.load() == 800);
+  }
+
+  printf("MeterFormat renders bar_format\n");
+  {
+    char buf[128];
+    auto render = [&](const tqdm::Params &p, size_t n, float elapsed,
+                      float rate) {
+      tqdm::MeterFormat f(p);
+      return std::string(buf, f.format(buf, sizeof(buf), n, elapsed, rate));
+    };
+    tqdm::Params p;
+    p.total = 100;
+    p.desc = "d";
+    CHECK(render(p, 50, 10, 5) ==
+          "d:  50%|#####     | 50/100 [00:10<00:10,  5.00it/s]");
+    CHECK(render(p, 33, 3725, 0.5f) ==
+          "d:  33%|###3      | 33/100 [1:02:05<02:14,  2.00s/it]");
+    p.ncols = 60;
+    CHECK(render(p, 100, 1, 0).size() == 60);
+    p.ncols = 0;
+    CHECK(render(p, 50, 10, 5) == "d:  50% 50/100 [00:10<00:10,  5.00it/s]");
+    p.ncols = -1;
+    p.total = size_t(-1);
+    p.unit = "B";
+    p.unit_scale = true;
+    CHECK(render(p, 123456, 1, 0) == "d: 123kB [00:01, 123kB/s]");
+    p.bar_format = "{{{n:5d}}} {percentage:.1f}% {rate_fmt:>12}";
+    bool threw = false;
+    try {
+      tqdm::MeterFormat f(p);
+    } catch (std::invalid_argument &) {
+      threw = true;
+    }
+    CHECK(threw);
+    p.bar_format = "{{{n:5d}}} [{bar}] {rate_fmt:10}|";
+    p.total = 4;
+    p.ncols = 27;
+    CHECK(render(p, 1, 1, 0) == "{    1} [#2   ] 1.00B/s   |");
+  }
+
+  printf("bars made from SharedParams share its compiled bar_format\n");
+  {
+    tqdm::Params p;
+    p.desc = "d";
+    p.f = fopen("/dev/null", "w");
+    {
+      tqdm::SharedParams shared(p);
+      CHECK(shared.layout(100) == shared.layout(4));
+      CHECK(shared.layout(100) != shared.layout(size_t(-1)));
+      CHECK(tqdm::SharedParams().layout(1) ==
+            tqdm::SharedParams().layout(2));
+      char buf[128];
+      tqdm::MeterFormat f(shared.layout(100), 100);
+      CHECK(std::string(buf, f.format(buf, sizeof(buf), 50, 10, 5)) ==
+            "d:  50%|#####     | 50/100 [00:10<00:10,  5.00it/s]");
+
+      std::vector<int> v(100, 1);
+      int sum = 0;
+      for (int b = 0; b < 10; ++b)
+        for (int x : tqdm::tqdm(v, shared))
+          sum += x;
+      CHECK(sum == 1000);
+      tqdm::Meter<> meter(shared, 7);
+      CHECK(meter.params().desc == "d" && meter.next_print_n() <= 7);
+      meter.close(7);
+    }
+    fclose(p.f);
+  }
+
+  printf("count_byte matches a plain loop\n");
+  {
+    std::vector<char> buf(1000);
+    for (size_t i = 0; i < buf.size(); ++i)
+      buf[i] = i % 7 == 0 || i % 13 == 0 ? '\n' : char(i);
+    for (size_t off = 0; off < 40; ++off)
+      for (size_t len = 0; off + len <= buf.size(); len += 37) {
+        size_t n = 0;
+        for (size_t i = off; i < off + len; ++i)
+          n += buf[i] == '\n';
+        CHECK(tqdm::count_byte(&buf[off], len, '\n') == n);
+      }
+    std::vector<char> zeros(300 * 32, '\0');  // >255 blocks per lane
+    CHECK(tqdm::count_byte(zeros.data(), zeros.size(), '\0') ==
+          zeros.size());
+  }
+
   return 0;
 }